@@ -0,0 +1,243 @@
+/* -------------------------------------
+ * Host accuracy check of the delay service (../src/delay.c).
+ *
+ * Runs Delay() and DelayUs() on a model of SysTick and the LPTMR in virtual
+ * time, for each core clock of CLOCK_SETUP in system_MKL25Z4.c, and
+ * compares each delay with the time that passed. Delays start at random
+ * points of the tick. The clock is changed between the setups as
+ * SystemCoreClockUpdate() would, without calling DelayInit() again, so the
+ * service must retune itself.
+ *
+ * Each access to a timer register costs HOST_ACCESS_CYCLES core clocks; the
+ * rest of the code is free, so the errors are those of the method, not of
+ * the compiler.
+ *
+ * Build and run from this directory, for each timer:
+ *
+ *   gcc -O2 -I. -I../include -o delay_check delay_check.c ../src/delay.c
+ *   gcc -O2 -DDELAY_TIMER=DELAY_LPTMR -I. -I../include \
+ *       -o delay_check_lptmr delay_check.c ../src/delay.c
+ *   ./delay_check
+ *
+ * The exit status is 1 if a delay is short or late by more than the
+ * tolerance of its timer.
+ * -------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <MKL25Z4.H>
+#include "delay.h"
+
+#define HOST_ACCESS_CYCLES (2) // Core clocks per timer register access.
+#define RUNS (64)              // Random start points per delay.
+
+uint32_t SystemCoreClock;
+SysTick_Type SysTick_Host;
+SIM_Type SIM_Host;
+LPTMR_Type LPTMR0_Host;
+
+extern void SysTick_Handler(void) __attribute__((weak));
+extern void LPTMR0_IRQHandler(void) __attribute__((weak));
+
+// -----------------------------------
+// Model
+// -----------------------------------
+
+double hostNs = 0;        // Virtual time.
+double hostHz = 0;        // Real core clock.
+uint32_t stCount = 0;     // SysTick counter.
+uint32_t stPublished = 0; // VAL as last seen by the firmware.
+int stPending = 0;
+double lpNext = 0;        // Time of the next LPO clock, 0 if stopped.
+int lpPending = 0;
+int lpEnabled = 0;        // NVIC enable of the LPTMR interrupt.
+int masked = 0;
+int inHandler = 0;
+
+// Advance the virtual time by 'cycles' core clocks.
+static void advance(uint64_t cycles) {
+    uint64_t c = cycles;
+    uint32_t step;
+
+    // SysTick counts down to 0, interrupts, and reloads at the next clock.
+    while ((SysTick_Host.CTRL & SysTick_CTRL_ENABLE_Msk) && c > 0) {
+        if (stCount == 0) {
+            stCount = SysTick_Host.LOAD;
+            c--;
+            continue;
+        }
+
+        step = (c < stCount) ? (uint32_t) c : stCount;
+        stCount -= step;
+        c -= step;
+
+        if (stCount == 0 && (SysTick_Host.CTRL & SysTick_CTRL_TICKINT_Msk))
+            stPending = 1;
+    }
+
+    hostNs += cycles * 1e9 / hostHz;
+
+    // The LPTMR compares every count (CMR 0) with the 1 kHz LPO.
+    if (!(LPTMR0_Host.CSR & LPTMR_CSR_TEN_MASK)) {
+        lpNext = 0;
+    } else if (lpNext == 0) {
+        lpNext = hostNs + 1e6;
+    } else {
+        while (hostNs >= lpNext) {
+            if (LPTMR0_Host.CSR & LPTMR_CSR_TIE_MASK)
+                lpPending = 1;
+            lpNext += 1e6;
+        }
+    }
+}
+
+// Run the pending interrupts, unless masked.
+static void deliver(void) {
+    if (masked || inHandler)
+        return;
+
+    inHandler = 1;
+    while (stPending || (lpPending && lpEnabled)) {
+        if (stPending) {
+            stPending = 0;
+            if (SysTick_Handler)
+                SysTick_Handler();
+        }
+        if (lpPending && lpEnabled) {
+            lpPending = 0;
+            if (LPTMR0_IRQHandler)
+                LPTMR0_IRQHandler();
+        }
+    }
+    inHandler = 0;
+}
+
+void HostAccess(void) {
+    // A write to VAL since the last access clears the counter.
+    if (SysTick_Host.VAL != stPublished)
+        stCount = 0;
+
+    advance(HOST_ACCESS_CYCLES);
+    SysTick_Host.VAL = stPublished = stCount;
+    deliver();
+}
+
+// Sleep to the next interrupt, which is pended but, if masked, not run.
+void HostWFI(void) {
+    double cycles = 1e12;
+
+    if ((SysTick_Host.CTRL & SysTick_CTRL_ENABLE_Msk)
+            && (SysTick_Host.CTRL & SysTick_CTRL_TICKINT_Msk))
+        cycles = (stCount) ? stCount : SysTick_Host.LOAD + 1.0;
+
+    if (lpNext != 0 && lpEnabled && (LPTMR0_Host.CSR & LPTMR_CSR_TIE_MASK)
+            && (lpNext - hostNs) * hostHz / 1e9 + 1 < cycles)
+        cycles = (lpNext - hostNs) * hostHz / 1e9 + 1;
+
+    if (cycles >= 1e12) {
+        fprintf(stderr, "WFI with no interrupt to wake up\n");
+        exit(2);
+    }
+
+    advance((uint64_t) cycles);
+    SysTick_Host.VAL = stPublished = stCount;
+    deliver();
+}
+
+void HostIRQMask(int m) {
+    masked = m;
+    deliver();
+}
+
+void HostNVICEnable(IRQn_Type irq, int enable) {
+    if (irq == LPTMR0_IRQn)
+        lpEnabled = enable;
+}
+
+// Let 'cycles' core clocks pass without timer accesses.
+static void idle(uint64_t cycles) {
+    advance(cycles);
+    SysTick_Host.VAL = stPublished = stCount;
+    deliver();
+}
+
+// -----------------------------------
+// Check
+// -----------------------------------
+
+const struct {
+    const char *name;
+    uint32_t clock;
+} Setups[] = {
+    {"CLOCK_SETUP 0", 41943040},
+    {"CLOCK_SETUP 1", 48000000},
+    {"CLOCK_SETUP 2", 8000000},
+};
+
+const uint32_t DelaysMs[] = {1, 2, 10, 100, 500};
+const uint32_t DelaysUs[] = {1, 10, 100, 999, 1000, 1500, 20000};
+
+uint32_t seed = 1;
+int failures = 0;
+
+// Time 'RUNS' delays from random points and print the error range.
+//   Param: delay, 1 for Delay(), 0 for DelayUs()
+static void check(uint32_t t, int ms) {
+    double us = (ms) ? t * 1000.0 : t;
+    double min = 1e12, max = -1e12, start, err, tolerance;
+    int i;
+
+    // Late by at most a tick with the LPTMR, or 2 us and 0.2% otherwise.
+    tolerance = (DELAY_TIMER == DELAY_LPTMR && us >= 1000)
+        ? 1002 : 2 + us * 0.002;
+
+    for (i = 0; i < RUNS; i++) {
+        seed = seed * 1103515245u + 12345u;
+        idle((seed >> 8) % (2 * (uint32_t) (hostHz / 1000)));
+
+        start = hostNs;
+        if (ms)
+            Delay(t);
+        else
+            DelayUs(t);
+        err = (hostNs - start) / 1000 - us;
+
+        if (err < min)
+            min = err;
+        if (err > max)
+            max = err;
+    }
+
+    printf("  %-8s %8u %12.3f %12.3f %s\n", (ms) ? "Delay" : "DelayUs", t,
+            min, max, (min < 0 || max > tolerance) ? "FAIL" : "ok");
+    if (min < 0 || max > tolerance)
+        failures++;
+}
+
+int main(void) {
+    unsigned s, i;
+
+    printf("timer %s, %d clocks per register access\n",
+            (DELAY_TIMER == DELAY_LPTMR) ? "LPTMR" : "SysTick",
+            HOST_ACCESS_CYCLES);
+
+    for (s = 0; s < sizeof Setups / sizeof Setups[0]; s++) {
+        // As SystemCoreClockUpdate() after a change of clock.
+        hostHz = SystemCoreClock = Setups[s].clock;
+        if (s == 0)
+            DelayInit();
+
+        printf("\n%s, %u Hz\n", Setups[s].name, Setups[s].clock);
+        printf("  %-8s %8s %12s %12s\n", "call", "time", "min err us",
+                "max err us");
+
+        for (i = 0; i < sizeof DelaysMs / sizeof DelaysMs[0]; i++)
+            check(DelaysMs[i], 1);
+        for (i = 0; i < sizeof DelaysUs / sizeof DelaysUs[0]; i++)
+            check(DelaysUs[i], 0);
+    }
+
+    printf("\n%d delays out of tolerance\n", failures);
+    return failures != 0;
+}
@@ -0,0 +1,108 @@
+/* -------------------------------------
+ * Host check of the event queue (../src/event.c).
+ *
+ * An interval timer signal stands in for the interrupt: like an interrupt,
+ * the handler runs on the thread of the main loop, between any two of its
+ * instructions. The handler posts numbered events, tens of thousands a
+ * second, and the main loop takes them, now and then too slowly, so that
+ * the ring fills. Every event taken must be the next one posted, less those
+ * counted in 'overflows', and none may be taken twice.
+ *
+ * Build and run from this directory:
+ *
+ *   gcc -O2 -I../include -o event_check event_check.c ../src/event.c
+ *   ./event_check [seconds]
+ *
+ * The exit status is 1 if an event is lost without being counted, or
+ * taken out of order.
+ * -------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <sys/time.h>
+#include "event.h"
+
+#define QUEUE (16)         // Slots in the ring.
+#define PERIOD_US (20)     // Interval of the timer signal.
+#define SLOW_EVERY (10000) // One event in this many is taken slowly.
+
+volatile struct Event ring[QUEUE];
+struct EventQueue queue = {ring, QUEUE};
+
+// Events offered to EventPost() by the handler, and the handler calls.
+volatile uint32_t offered = 0;
+volatile uint32_t signals = 0;
+
+// Post the next event, and sometimes a burst of them.
+static void handler(int sig) {
+    int n = (signals++ % 64 == 0) ? QUEUE / 2 : 1;
+
+    (void) sig;
+    while (n-- > 0) {
+        EventPost(&queue, 1, offered & 0xffff, offered);
+        offered++;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    double seconds = (argc > 1) ? atof(argv[1]) : 2.0;
+    struct itimerval it = {{0, PERIOD_US}, {0, PERIOD_US}};
+    struct timeval start, now;
+    struct Event e;
+    uint32_t expected = 0, taken = 0, skipped = 0, errors = 0;
+    volatile uint32_t spin;
+
+    signal(SIGALRM, handler);
+    setitimer(ITIMER_REAL, &it, 0);
+    gettimeofday(&start, 0);
+
+    do {
+        if (EventGet(&queue, &e)) {
+            // Events dropped by a full ring leave a gap in the numbers.
+            if (e.stamp < expected || e.data != (e.stamp & 0xffff)) {
+                if (errors++ < 10)
+                    printf("event %u taken, %u expected\n", e.stamp,
+                            expected);
+            } else {
+                skipped += e.stamp - expected;
+            }
+
+            expected = e.stamp + 1;
+            taken++;
+
+            // A slow main loop, for the ring to fill.
+            if (taken % SLOW_EVERY == 0)
+                for (spin = 0; spin < 2000000; spin++);
+        }
+
+        gettimeofday(&now, 0);
+    } while (now.tv_sec - start.tv_sec
+            + (now.tv_usec - start.tv_usec) / 1e6 < seconds);
+
+    // Stop the signal, then take the rest.
+    it.it_value.tv_usec = 0;
+    it.it_interval.tv_usec = 0;
+    setitimer(ITIMER_REAL, &it, 0);
+
+    while (EventGet(&queue, &e)) {
+        skipped += e.stamp - expected;
+        expected = e.stamp + 1;
+        taken++;
+    }
+    skipped += offered - expected;
+
+    printf("%u signals, %u events posted, %u taken, %u overflows, "
+            "peak %u of %u\n", signals, offered, taken, queue.overflows,
+            queue.peak, QUEUE);
+    printf("%u events missing, %u counted as overflows\n", skipped,
+            queue.overflows);
+
+    if (skipped != queue.overflows || taken + skipped != offered)
+        errors++;
+
+    printf("%s\n", errors ? "FAIL" : "ok");
+
+    return errors ? 1 : 0;
+}
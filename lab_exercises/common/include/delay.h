@@ -0,0 +1,47 @@
+#ifndef DELAY_H
+#define DELAY_H
+
+#include <stdint.h>
+
+// Delay and timebase service shared by the lab exercises.
+//
+// A timer interrupts every millisecond and counts DelayTicks. Delays in ms
+// sleep (WFI) between the ticks; delays in us count core clocks on the
+// SysTick counter. The service follows SystemCoreClock: after changing the
+// clocks, call SystemCoreClockUpdate() and the next delay retunes the timers.
+
+// Timer of the millisecond tick.
+//   DELAY_SYSTICK: SysTick, from the core clock. Delays in ms are exact to a
+//     few core clocks.
+//   DELAY_LPTMR: LPTMR0, from the 1 kHz LPO, which does not depend on the
+//     core clock and keeps running in the stop modes. SysTick runs without
+//     interrupts as the core clock counter. Delays in ms are exact to a tick,
+//     and the LPO is not trimmed, so it is far less accurate than the core
+//     clock.
+#define DELAY_SYSTICK (0)
+#define DELAY_LPTMR (1)
+
+#ifndef DELAY_TIMER
+#define DELAY_TIMER DELAY_SYSTICK
+#endif
+
+// Start the timers. Called by the first delay if not called before.
+extern void DelayInit(void);
+
+// Wait for at least 'ms' milliseconds, asleep.
+//   Param: time in ms
+extern void Delay(uint32_t ms);
+
+// Wait for at least 'us' microseconds. Whole milliseconds are slept, and
+// the rest spins on the SysTick counter.
+//   Param: time in us
+extern void DelayUs(uint32_t us);
+
+// Milliseconds since DelayInit(), counted by the tick interrupt. Wraps after
+// 49 days, so use differences.
+extern volatile uint32_t DelayTicks;
+
+// Called from the tick interrupt every millisecond, if set.
+extern void (*DelayTickHook)(void);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef EVENT_H
+#define EVENT_H
+
+#include <stdint.h>
+
+// Event queues from interrupt handlers to the main loop, shared by the lab
+// exercises.
+//
+// A queue is a ring with a single producer, one interrupt handler, and a
+// single consumer, the main loop. Only the producer writes 'head' and only
+// the consumer 'tail'. Both count up, and their difference is the number of
+// events queued, so neither masks the other's interrupts. Each index is one
+// aligned word with one writer, so the queue needs no LDREX/STREX, which the
+// Cortex-M0+ lacks. Handlers of one priority cannot preempt each other and
+// may share a queue; handlers of different priorities need one queue each.
+//
+// Unlike a flag, a queue keeps every event until it is taken: a second press
+// before the main loop has seen the first is not lost.
+
+// An event, as posted by an interrupt handler.
+struct Event {
+    uint16_t type;  // Set by the lab, e.g. EVENT_BUTTON.
+    uint16_t data;  // Depends on the type.
+    uint32_t stamp; // Time of the event, e.g. DelayTicks.
+};
+
+struct EventQueue {
+    volatile struct Event *ring;
+    unsigned size;               // Slots in the ring; a power of 2.
+    volatile unsigned head;      // Events posted; written by the producer.
+    volatile unsigned tail;      // Events taken; written by the consumer.
+    volatile uint32_t overflows; // Events dropped as the ring was full.
+    volatile unsigned peak;      // Most events queued at once.
+};
+
+// Queue an event (producer only). A full ring drops the event and counts it
+// in 'overflows'.
+//   Param: queue, type, data and time stamp of the event
+//   Return: 1 if queued, 0 if dropped
+extern int EventPost(struct EventQueue *q, unsigned type, unsigned data,
+        uint32_t stamp);
+
+// Take the oldest event (consumer only).
+//   Param: queue, event to fill
+//   Return: 1 if an event was taken, 0 if the queue was empty
+extern int EventGet(struct EventQueue *q, struct Event *e);
+
+// Number of events queued.
+extern unsigned EventCount(struct EventQueue *q);
+
+// Discard all the queued events (consumer only).
+extern void EventFlush(struct EventQueue *q);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef GPIO_FAST_H
+#define GPIO_FAST_H
+
+// Ports used by the lab exercises, shared by their gpio_defs.h.
+
+// GPIO access.
+//   0: through the peripheral bridge (PTB, PTD, PTE).
+//   1: through the single-cycle IOPORT of the core (FPTB, FPTD, FPTE): the
+//      same registers, in one clock instead of a bus access.
+#ifndef GPIO_FAST
+#define GPIO_FAST (1)
+#endif
+
+#if GPIO_FAST
+#define GPIO_B FPTB
+#define GPIO_D FPTD
+#define GPIO_E FPTE
+#else
+#define GPIO_B PTB
+#define GPIO_D PTD
+#define GPIO_E PTE
+#endif
+
+#endif
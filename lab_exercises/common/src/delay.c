@@ -0,0 +1,148 @@
+#include <MKL25Z4.H>
+#include "delay.h"
+
+// -----------------------------------
+// Delay and timebase service
+// -----------------------------------
+
+volatile uint32_t DelayTicks = 0;
+void (*DelayTickHook)(void) = 0;
+
+// SystemCoreClock the timers are set up for, 0 before DelayInit().
+uint32_t delayClock = 0;
+
+// Core clocks per us, rounded up so that a delay is never short.
+uint32_t delayCyclesPerUs = 0;
+
+// Core clocks in one SysTick period. With SysTick ticks, rounded up as
+// well: 41943040 Hz (CLOCK_SETUP 0) is not a whole number of clocks per ms.
+uint32_t delayPeriod = 0;
+
+// Set SysTick up for the current SystemCoreClock.
+static void delayTune(void) {
+    delayClock = SystemCoreClock;
+    delayCyclesPerUs = (SystemCoreClock + 999999) / 1000000;
+
+#if DELAY_TIMER == DELAY_SYSTICK
+    // One tick per ms.
+    delayPeriod = (SystemCoreClock + 999) / 1000;
+    SysTick->CTRL = 0;
+    SysTick->LOAD = delayPeriod - 1;
+    SysTick->VAL = 0;
+    SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_TICKINT_Msk
+        | SysTick_CTRL_ENABLE_Msk;
+#else
+    // Free running core clock counter, without interrupts.
+    delayPeriod = SysTick_LOAD_RELOAD_Msk + 1;
+    SysTick->CTRL = 0;
+    SysTick->LOAD = SysTick_LOAD_RELOAD_Msk;
+    SysTick->VAL = 0;
+    SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk;
+#endif
+}
+
+// Start the timers.
+void DelayInit(void) {
+    delayTune();
+
+#if DELAY_TIMER == DELAY_LPTMR
+    // Enable clock to the LPTMR.
+    SIM->SCGC5 |= SIM_SCGC5_LPTMR_MASK;
+
+    // Set LPTMR0_PSR
+    //   01 --> PCS - LPO, 1 kHz
+    //   1 --> PBYP - no prescaler, count every LPO clock
+    LPTMR0->CSR = 0; // Disable while configuring.
+    LPTMR0->PSR = LPTMR_PSR_PCS(1) | LPTMR_PSR_PBYP_MASK;
+    LPTMR0->CMR = 0; // TCF at every count, so every ms.
+    LPTMR0->CSR = LPTMR_CSR_TIE_MASK | LPTMR_CSR_TEN_MASK;
+
+    NVIC_SetPriority(LPTMR0_IRQn, 0);
+    NVIC_ClearPendingIRQ(LPTMR0_IRQn);
+    NVIC_EnableIRQ(LPTMR0_IRQn);
+#endif
+}
+
+// Set up the timers again if SystemCoreClock has changed since.
+static void delayCheck(void) {
+    if (delayClock == 0)
+        DelayInit();
+    else if (SystemCoreClock != delayClock)
+        delayTune();
+}
+
+// Tick every ms.
+#if DELAY_TIMER == DELAY_SYSTICK
+void SysTick_Handler(void) {
+#else
+void LPTMR0_IRQHandler(void) {
+    LPTMR0->CSR |= LPTMR_CSR_TCF_MASK; // Write 1 to clear.
+#endif
+    DelayTicks++;
+
+    if (DelayTickHook)
+        DelayTickHook();
+}
+
+// Sleep until 'ticks' ticks have passed since 'start'. The test and the WFI
+// are made with interrupts masked, so that a tick between them is not
+// missed; a pending interrupt still ends the WFI.
+static void delaySleep(uint32_t start, uint32_t ticks) {
+    __disable_irq();
+    while (DelayTicks - start < ticks) {
+        __WFI();
+
+        __enable_irq(); // Run the interrupt that woke the core.
+        __disable_irq();
+    }
+    __enable_irq();
+}
+
+// Spin for 'cycles' core clocks on the SysTick down counter. The counter
+// is read at least once a period, so each reload is counted.
+static void delaySpin(uint32_t cycles) {
+    uint32_t last = SysTick->VAL;
+    uint32_t elapsed = 0;
+    uint32_t now;
+
+    while (elapsed < cycles) {
+        now = SysTick->VAL;
+        elapsed += (last >= now) ? last - now : last + delayPeriod - now;
+        last = now;
+    }
+}
+
+void Delay(uint32_t ms) {
+#if DELAY_TIMER == DELAY_SYSTICK
+    uint32_t start, phase;
+
+    delayCheck();
+
+    // Read again if a tick came between the two reads.
+    do {
+        start = DelayTicks;
+        phase = SysTick->VAL;
+    } while (start != DelayTicks);
+
+    // Sleep for the whole ticks, then spin to the same point of the next
+    // one.
+    delaySleep(start, ms);
+    while (DelayTicks - start == ms && SysTick->VAL > phase);
+#else
+    delayCheck();
+
+    // The first tick can come at once, so wait for one more.
+    delaySleep(DelayTicks, ms + 1);
+#endif
+}
+
+void DelayUs(uint32_t us) {
+    delayCheck();
+
+    if (us >= 1000) {
+        Delay(us / 1000);
+        us = us % 1000;
+    }
+
+    delaySpin(us * delayCyclesPerUs);
+}
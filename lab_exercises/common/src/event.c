@@ -0,0 +1,59 @@
+#include "event.h"
+
+// -----------------------------------
+// Event queues
+// -----------------------------------
+
+// Queue an event (producer only). The slot is written before 'head', which
+// publishes it; the consumer does not read a slot until it sees the new
+// 'head'. Volatile accesses keep that order, and the M0+ does not reorder
+// them, as the handler and the main loop run on the same core.
+int EventPost(struct EventQueue *q, unsigned type, unsigned data,
+        uint32_t stamp) {
+    unsigned head = q->head;
+    unsigned queued = head - q->tail;
+    volatile struct Event *slot;
+
+    if (queued >= q->size) {
+        q->overflows++;
+        return 0;
+    }
+
+    slot = &q->ring[head & (q->size - 1)];
+    slot->type = type;
+    slot->data = data;
+    slot->stamp = stamp;
+    q->head = head + 1; // Publishes the event.
+
+    if (queued + 1 > q->peak)
+        q->peak = queued + 1;
+
+    return 1;
+}
+
+// Take the oldest event (consumer only).
+int EventGet(struct EventQueue *q, struct Event *e) {
+    unsigned tail = q->tail;
+    volatile struct Event *slot;
+
+    if (tail == q->head)
+        return 0;
+
+    slot = &q->ring[tail & (q->size - 1)];
+    e->type = slot->type;
+    e->data = slot->data;
+    e->stamp = slot->stamp;
+    q->tail = tail + 1; // Frees the slot for the producer.
+
+    return 1;
+}
+
+// Number of events queued.
+unsigned EventCount(struct EventQueue *q) {
+    return q->head - q->tail;
+}
+
+// Discard all the queued events (consumer only).
+void EventFlush(struct EventQueue *q) {
+    q->tail = q->head;
+}
@@ -1,18 +1,10 @@
 #include <MKL25Z4.H>
 #include "gpio_defs.h"
+#include "delay.h"
 
 // Demonstration of simple digital output.
 // Use RGB LED on Freedom board.
 
-void Delay(unsigned int time_del) {
-    // Delay is about 1 millisecond * time_del.
-    volatile int t;
-
-    while (time_del--) {
-        for (t = 4800; t > 0; t--);
-    }
-}
-
 // Each LED corresponds to a bit on a port.
 //
 //   - Red LED connected to Port B (PTB), bit 18 (RED_LED_POS).
@@ -29,22 +21,22 @@ void Delay(unsigned int time_del) {
 
 void redGreenBlue(void) {
     // Set just red on.
-    PTB->PDOR = ~ MASK(RED_LED_POS);
-    PTD->PDOR = 0xFFFFFFFF;
+    GPIO_B->PDOR = ~ MASK(RED_LED_POS);
+    GPIO_D->PDOR = 0xFFFFFFFF;
 
     // Wait for 500ms.
     Delay(500);
 
     // Set just green on.
-    PTB->PDOR = ~ MASK(GREEN_LED_POS);
-    PTD->PDOR = 0xFFFFFFFF;
+    GPIO_B->PDOR = ~ MASK(GREEN_LED_POS);
+    GPIO_D->PDOR = 0xFFFFFFFF;
 
     // Wait for 500ms.
     Delay(500);
 
     // Set just blue on.
-    PTB->PDOR = 0xFFFFFFFF;
-    PTD->PDOR = ~ MASK(BLUE_LED_POS);
+    GPIO_B->PDOR = 0xFFFFFFFF;
+    GPIO_D->PDOR = ~ MASK(BLUE_LED_POS);
 
     // Wait for 500ms.
     Delay(500);
@@ -73,61 +65,64 @@ int main (void) {
     PORTD->PCR[BLUE_LED_POS] |= PORT_PCR_MUX(1);
 
     // Set ports to outputs.
-    PTB->PDDR |= MASK(RED_LED_POS) | MASK(GREEN_LED_POS);
-    PTD->PDDR |= MASK(BLUE_LED_POS);
+    GPIO_B->PDDR |= MASK(RED_LED_POS) | MASK(GREEN_LED_POS);
+    GPIO_D->PDDR |= MASK(BLUE_LED_POS);
 
     // Turn off LEDs.
-    PTB->PSOR = MASK(RED_LED_POS) | MASK(GREEN_LED_POS);
-    PTD->PSOR = MASK(BLUE_LED_POS);
+    GPIO_B->PSOR = MASK(RED_LED_POS) | MASK(GREEN_LED_POS);
+    GPIO_D->PSOR = MASK(BLUE_LED_POS);
+
+    // Start the delay service.
+    DelayInit();
     // End of configuration code.
 
     // Code for flashing the LEDs.
     while (1) {
         // Red only
-        PTB->PDOR = ~ MASK(RED_LED_POS);
-        PTD->PDOR = 0xFFFFFFFF;
+        GPIO_B->PDOR = ~ MASK(RED_LED_POS);
+        GPIO_D->PDOR = 0xFFFFFFFF;
 
         // Wait for 500ms.
         Delay(500);
 
         // Green only.
-        PTB->PDOR = ~ MASK(GREEN_LED_POS);
-        PTD->PDOR = 0xFFFFFFFF;
+        GPIO_B->PDOR = ~ MASK(GREEN_LED_POS);
+        GPIO_D->PDOR = 0xFFFFFFFF;
 
         // Wait for 500ms.
         Delay(500);
 
         // Blue only.
-        PTB->PDOR = 0xFFFFFFFF;
-        PTD->PDOR = ~ MASK(BLUE_LED_POS);
+        GPIO_B->PDOR = 0xFFFFFFFF;
+        GPIO_D->PDOR = ~ MASK(BLUE_LED_POS);
 
         // Wait for 500ms.
         Delay(500);
 
         // Red and green.
-        PTB->PDOR = ~ (MASK(RED_LED_POS) | MASK(GREEN_LED_POS));
-        PTD->PDOR = 0xFFFFFFFF;
+        GPIO_B->PDOR = ~ (MASK(RED_LED_POS) | MASK(GREEN_LED_POS));
+        GPIO_D->PDOR = 0xFFFFFFFF;
 
         // Wait for 500ms.
         Delay(500);
 
         // Red and blue.
-        PTB->PDOR = ~ MASK(RED_LED_POS);
-        PTD->PDOR = ~ MASK(BLUE_LED_POS);
+        GPIO_B->PDOR = ~ MASK(RED_LED_POS);
+        GPIO_D->PDOR = ~ MASK(BLUE_LED_POS);
 
         // Wait for 500ms.
         Delay(500);
 
         // Green and blue.
-        PTB->PDOR = ~ MASK(GREEN_LED_POS);
-        PTD->PDOR = ~ MASK(BLUE_LED_POS);
+        GPIO_B->PDOR = ~ MASK(GREEN_LED_POS);
+        GPIO_D->PDOR = ~ MASK(BLUE_LED_POS);
 
         // Wait for 500ms.
         Delay(500);
 
         // Red, green and blue.
-        PTB->PDOR = ~ (MASK(RED_LED_POS) | MASK(GREEN_LED_POS));
-        PTD->PDOR = ~ MASK(BLUE_LED_POS);
+        GPIO_B->PDOR = ~ (MASK(RED_LED_POS) | MASK(GREEN_LED_POS));
+        GPIO_D->PDOR = ~ MASK(BLUE_LED_POS);
 
         // Wait for 500ms.
         Delay(500);
@@ -8,5 +8,8 @@
 #define GREEN_LED_POS (19)  // on port B
 #define BLUE_LED_POS (1)    // on port D
 
+// GPIO_B, GPIO_D and GPIO_E, selected by GPIO_FAST.
+#include "gpio_fast.h"
+
 #endif
 // *******************************ARM University Program Copyright  ARM Ltd 2013*************************************
@@ -1,5 +1,6 @@
 #include <MKL25Z4.H>
 #include "gpio_defs.h"
+#include "delay.h"
 #include "switches.h"
 
 volatile int count = 0;
@@ -7,15 +8,6 @@ volatile int count = 0;
 // Demonstration of digital input using an interrupt.
 // Use RGB LED on Freedom board.
 
-void Delay(unsigned int time_del) {
-    // Delay is about 1 millisecond * time_del.
-    volatile int t;
-
-    while (time_del--) {
-        for (t = 4800; t > 0; t--);
-    }
-}
-
 // Each LED corresponds to a bit on a port:
 //
 //   - Red LED connected to Port B (PTB), bit 18 (RED_LED_POS).
@@ -34,6 +26,8 @@ void Delay(unsigned int time_del) {
   MAIN function
  *----------------------------------------------------------------------------*/
 int main (void) {
+    struct Event press; // Press taken from the queue.
+
     // Configuration steps:
     //
     //   1. Enable clock to GPIO ports
@@ -53,12 +47,15 @@ int main (void) {
     PORTD->PCR[BLUE_LED_POS] |= PORT_PCR_MUX(1);
 
     // Set ports to outputs.
-    PTB->PDDR |= MASK(RED_LED_POS) | MASK(GREEN_LED_POS);
-    PTD->PDDR |= MASK(BLUE_LED_POS);
+    GPIO_B->PDDR |= MASK(RED_LED_POS) | MASK(GREEN_LED_POS);
+    GPIO_D->PDDR |= MASK(BLUE_LED_POS);
 
     // Turn off LEDs.
-    PTB->PSOR = MASK(RED_LED_POS) | MASK(GREEN_LED_POS);
-    PTD->PSOR = MASK(BLUE_LED_POS);
+    GPIO_B->PSOR = MASK(RED_LED_POS) | MASK(GREEN_LED_POS);
+    GPIO_D->PSOR = MASK(BLUE_LED_POS);
+
+    // Start the delay service.
+    DelayInit();
     // End of configuration code.
 
     // Initialise the switch (or button) to generate an interrupt.
@@ -67,23 +64,21 @@ int main (void) {
     // Flash the red LED on each button press.
     // Note: blue and green LEDs are initialised but not used.
     while (1) {
-        if (buttonPress) {
+        if (EventGet(&buttonEvents, &press)) {
             count++;
 
             if (count & 1)
-                PTB->PCOR = MASK(RED_LED_POS);
+                GPIO_B->PCOR = MASK(RED_LED_POS);
 
             if (count & 2)
-                PTB->PCOR = MASK(GREEN_LED_POS);
+                GPIO_B->PCOR = MASK(GREEN_LED_POS);
 
             if (count & 4)
-                PTD->PCOR = MASK(BLUE_LED_POS);
-
-            buttonPress = 0;
+                GPIO_D->PCOR = MASK(BLUE_LED_POS);
         } else {
-            PTB->PSOR = MASK(RED_LED_POS);
-            PTB->PSOR = MASK(GREEN_LED_POS);
-            PTD->PSOR = MASK(BLUE_LED_POS);
+            GPIO_B->PSOR = MASK(RED_LED_POS);
+            GPIO_B->PSOR = MASK(GREEN_LED_POS);
+            GPIO_D->PSOR = MASK(BLUE_LED_POS);
         }
 
         // Wait for 1000ms.
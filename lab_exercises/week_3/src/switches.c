@@ -1,9 +1,11 @@
 #include <MKL25Z4.H>
+#include "delay.h"
 #include "switches.h"
 
 // Demonstration of digital input using an interrupt.
 
-volatile unsigned buttonPress=0;
+volatile struct Event buttonRing[BUTTON_QUEUE];
+struct EventQueue buttonEvents = {buttonRing, BUTTON_QUEUE};
 
 // Initialise Port D pin 6 as an input, with an interrupt.
 void init_switch(void) {
@@ -16,7 +18,7 @@ void init_switch(void) {
         PORT_PCR_PE_MASK | PORT_PCR_IRQC(0x0a);
 
     // Set port D switch bit to inputs.
-    PTD->PDDR &= ~MASK(BUTTON_POS);
+    GPIO_D->PDDR &= ~MASK(BUTTON_POS);
 
     // Enable Interrupts.
     NVIC_SetPriority(PORTD_IRQn, 128); // 0, 64, 128 or 192
@@ -29,12 +31,13 @@ void init_switch(void) {
  *
  *   - Clear the pending request.
  *   - Test the bit for pin 6 to see if it generated the interrupt.
+ *   - Queue the press for the main loop.
  */
 void PORTD_IRQHandler(void) {
     NVIC_ClearPendingIRQ(PORTD_IRQn);
 
     if ((PORTD->ISFR & MASK(BUTTON_POS))) {
-        buttonPress = 1;
+        EventPost(&buttonEvents, EVENT_BUTTON, 0, DelayTicks);
     }
 
     // Clear status flags.
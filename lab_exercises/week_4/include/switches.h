@@ -1,14 +1,19 @@
 #ifndef SWITCHES_H
 #define SWITCHES_H
 #include "gpio_defs.h"
+#include "event.h"
 
 // Switches is on port D for interrupt support
 #define BUTTON_POS (6)
 
+#define BUTTON_QUEUE (8) // Presses kept until taken; a power of 2.
+#define EVENT_BUTTON (1) // Event type of a press.
+
 // Function prototypes
 extern void init_switch(void);
 
 // Shared variables
-extern volatile unsigned buttonPress;
+// Presses, posted by the interrupt with the DelayTicks of the press.
+extern struct EventQueue buttonEvents;
 #endif
 // *******************************ARM University Program Copyright  ARM Ltd 2013*************************************   
@@ -1,5 +1,6 @@
 #include <MKL25Z4.H>
 #include "gpio_defs.h"
+#include "delay.h"
 #include "switches.h"
 
 volatile int counter = 0;
@@ -8,15 +9,6 @@ int state = 0;
 // Demonstration of digital input using an interrupt.
 // Use RGB LED on Freedom board.
 
-void Delay(unsigned int time_del) {
-    // Delay is about 1 millisecond * time_del.
-    volatile int t;
-
-    while (time_del--) {
-        for (t = 4800; t > 0; t--);
-    }
-}
-
 // Each LED corresponds to a bit on a port:
 //
 //   - Red LED connected to Port B (PTB), bit 18 (RED_LED_POS).
@@ -35,6 +27,8 @@ void Delay(unsigned int time_del) {
   MAIN function
  *----------------------------------------------------------------------------*/
 int main (void) {
+    struct Event press; // Press taken from the queue.
+
     // Configuration steps:
     //
     //   1. Enable clock to GPIO ports
@@ -54,12 +48,15 @@ int main (void) {
     PORTD->PCR[BLUE_LED_POS] |= PORT_PCR_MUX(1);
 
     // Set ports to outputs.
-    PTB->PDDR |= MASK(RED_LED_POS) | MASK(GREEN_LED_POS);
-    PTD->PDDR |= MASK(BLUE_LED_POS);
+    GPIO_B->PDDR |= MASK(RED_LED_POS) | MASK(GREEN_LED_POS);
+    GPIO_D->PDDR |= MASK(BLUE_LED_POS);
 
     // Turn off LEDs.
-    PTB->PSOR = MASK(RED_LED_POS) | MASK(GREEN_LED_POS);
-    PTD->PSOR = MASK(BLUE_LED_POS);
+    GPIO_B->PSOR = MASK(RED_LED_POS) | MASK(GREEN_LED_POS);
+    GPIO_D->PSOR = MASK(BLUE_LED_POS);
+
+    // Start the delay service.
+    DelayInit();
     // End of configuration code.
 
     // Initialise the switch (or button) to generate an interrupt.
@@ -69,9 +66,8 @@ int main (void) {
         switch(state) {
             // LED off
             case 0:
-                if(buttonPress) {
-                    buttonPress = 0;
-                    PTB->PDOR = ~ MASK(RED_LED_POS);
+                if(EventGet(&buttonEvents, &press)) {
+                    GPIO_B->PDOR = ~ MASK(RED_LED_POS);
                     counter = 0;
                     state = 1;
                 }
@@ -80,12 +76,11 @@ int main (void) {
 
                 // Flash on
             case 1:
-                if(buttonPress) {
-                    buttonPress = 0;
+                if(EventGet(&buttonEvents, &press)) {
                     state = 3;
                 } else {
                     Delay(500);
-                    PTB->PDOR = 0xFFFFFFFF;
+                    GPIO_B->PDOR = 0xFFFFFFFF;
                     state = 2;
                 }
 
@@ -94,14 +89,13 @@ int main (void) {
                 // Flash off
             case 2:
                 if(counter == 9) {
-                    PTB->PDOR = 0xFFFFFFFF;
+                    GPIO_B->PDOR = 0xFFFFFFFF;
                     state = 0;
-                } else if(buttonPress) {
-                    buttonPress = 0;
+                } else if(EventGet(&buttonEvents, &press)) {
                     state = 0;
                 } else {
                     Delay(500);
-                    PTB->PDOR = ~ MASK(RED_LED_POS);
+                    GPIO_B->PDOR = ~ MASK(RED_LED_POS);
                     counter++;
                     state = 1;
                 }
@@ -111,7 +105,7 @@ int main (void) {
                 // Flash on B (Last flash)
             case 3:
                 Delay(500);
-                PTB->PDOR = 0xFFFFFFFF;
+                GPIO_B->PDOR = 0xFFFFFFFF;
                 break;
         }
     }
@@ -1,23 +1,12 @@
 #include <MKL25Z4.H>
 #include "gpio_defs.h"
+#include "delay.h"
 #include "adc_defs.h"
 
 // Demonstration of simple ADC.
 // Use ADC0_SE8, PTB0, J10, pin 2.
 // Use RGB LED on Freedom board.
 
-/*
- * Simple and imprecise delay function.
- */
-void Delay(unsigned int time_del) {
-    // Delay is about 1 millisecond * time_del.
-    volatile int t;
-
-    while (time_del--) {
-        for (t = 4800; t > 0; t--);
-    }
-}
-
 // Cycle through the colours red, gren and blue.
 void redGreenBlue(void) {
     // Each LED corresponds to a bit on a port:
@@ -36,22 +25,22 @@ void redGreenBlue(void) {
     //   - Turn all LEDs off: PTx->PDOR = 0xFFFFFFFF;
 
     // Set just red on.
-    PTB->PDOR = ~ MASK(RED_LED_POS);
-    PTD->PDOR = 0xFFFFFFFF;
+    GPIO_B->PDOR = ~ MASK(RED_LED_POS);
+    GPIO_D->PDOR = 0xFFFFFFFF;
 
     // Wait for 500ms.
     Delay(500);
 
     // Set just green on.
-    PTB->PDOR = ~ MASK(GREEN_LED_POS);
-    PTD->PDOR = 0xFFFFFFFF;
+    GPIO_B->PDOR = ~ MASK(GREEN_LED_POS);
+    GPIO_D->PDOR = 0xFFFFFFFF;
 
     // Wait for 500ms.
     Delay(500);
 
     // Set just blue on.
-    PTB->PDOR = 0xFFFFFFFF;
-    PTD->PDOR = ~ MASK(BLUE_LED_POS);
+    GPIO_B->PDOR = 0xFFFFFFFF;
+    GPIO_D->PDOR = ~ MASK(BLUE_LED_POS);
 
     // Wait for 500ms.
     Delay(500);
@@ -74,12 +63,12 @@ void Init_LED() {
     PORTD->PCR[BLUE_LED_POS] |= PORT_PCR_MUX(1);
 
     // Set ports to outputs.
-    PTB->PDDR |= MASK(RED_LED_POS) | MASK(GREEN_LED_POS);
-    PTD->PDDR |= MASK(BLUE_LED_POS);
+    GPIO_B->PDDR |= MASK(RED_LED_POS) | MASK(GREEN_LED_POS);
+    GPIO_D->PDDR |= MASK(BLUE_LED_POS);
 
     // Turn off LEDs.
-    PTB->PSOR = MASK(RED_LED_POS) | MASK(GREEN_LED_POS);
-    PTD->PSOR = MASK(BLUE_LED_POS);
+    GPIO_B->PSOR = MASK(RED_LED_POS) | MASK(GREEN_LED_POS);
+    GPIO_D->PSOR = MASK(BLUE_LED_POS);
 }
 
 // Initialise ADC.
@@ -149,6 +138,9 @@ int main (void) {
     // Initialise ADC.
     Init_ADC();
 
+
+    // Start the delay service.
+    DelayInit();
     // End of configuration code.
 
     while (1) {
@@ -0,0 +1,449 @@
+/* -------------------------------------
+ * Host benchmark: transition-table STM (stm.c) against the switch STM it
+ * replaced (stm_switch.c), and the sliding-window integer sampler of stm.c
+ * against the float five-sample batch it replaced (measure_float.c).
+ *
+ * Both engines are driven through the same scenario: one initiation pass,
+ * a button press to start normal operation and then a press every crossing
+ * cycle. The signal, button and ADC functions of pelican.c are replaced by
+ * models below, so only the STM code itself is timed. The switch engine gets
+ * the probe readings its own checks accept (SwitchSamples), so both run the
+ * same state sequence; the bench says so if their final state, states visited
+ * or transitions differ. Each frame is timed with the time stamp counter of
+ * the PC, in its clocks.
+ *
+ * Both measurement paths are fed the same noisy samples for a RED and
+ * DONTWALK state, for their time per frame and the frames that fail the
+ * window check, and then a step (RED failing) at every frame of the state,
+ * for the frames to detection. The PC has a floating point unit, so the host
+ * times understate the cost of float on the Cortex-M0+; StmStats gives the
+ * clocks per frame on the board.
+ *
+ * Last, executeFrame() runs 1, 2, 4... crossings, up to CROSSINGS, through
+ * the scenario, each with its presses at its own time, for the time of a
+ * whole frame against the number of crossings. StmFrameStats gives the same
+ * on the board.
+ *
+ * Build and run from this directory (without the frame statistics, which
+ * would be timed with the table, and with contexts for 16 crossings; the
+ * pin map of pelican.c, which has 2, is not linked):
+ *
+ *   gcc -O2 -DSTM_STATS=0 -DCROSSINGS=16 -I. -I../include -o bench_stm \
+ *       bench_stm.c registers.c ../src/stm.c stm_switch.c measure_float.c
+ *   ./bench_stm [frames]
+ *
+ * Code size of the two engines:
+ *
+ *   gcc -Os -DSTM_STATS=0 -I. -I../include -c ../src/stm.c stm_switch.c
+ *   size stm.o stm_switch.o
+ * -------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include <MKL25Z4.H>
+#include "pelican.h"
+#include "stm.h"
+#include "calib.h"
+
+extern int executeSTMSwitch(int curr_state);
+extern void resetSTMSwitch(void);
+
+extern void samplerReset(struct Crossing *c, int state);
+extern int samplerUpdate(struct Crossing *c, int state);
+extern int outOfWindow(const struct Crossing *c, unsigned probe, int state);
+
+extern volatile float voltagesFloat[6];
+extern float voltMeasurementFloat(int cycleCounter, int time);
+extern int outOfWindowFloat(unsigned outputs, float volt);
+
+#define PRESS_PERIOD (3000) // Frames between button presses.
+#define PRESS_OFFSET (377) // Frames between the presses of two crossings.
+#define MEASURE_STATE (REDANDDONTWALK) // Measured state, RED and DONTWALK.
+#define MEASURE_NOISE (8) // Peak sample error, in percent.
+#define STEP_FRAMES (100) // Frames of the state in the step test.
+#define HISTOGRAM (1024) // Clocks per frame counted for the median.
+
+// -----------------------------------
+// Models of the pelican.c interface
+// -----------------------------------
+
+// Signals that are on, one bit per PelicanSignal, per crossing.
+unsigned lit[CROSSINGS];
+
+// ADC counts drawn by each lamp.
+const unsigned LampCounts[6] = {400, 380, 420, 300, 310, 250};
+
+// Pending button press, per crossing.
+int pressed[CROSSINGS];
+
+// Sample returned by Measure() in the measurement benchmark; 0 to model the
+// lamps that are on.
+unsigned sample;
+
+// Sample returned by Measure() to the switch engine in each state; 0 to model
+// the lamps that are on. Its checks for GREEN and WAIT leave out DONTWALK, and
+// for WALK leave out RED, so the sum of the lamps that are on would take it to
+// WAIT flashing; these are readings inside its windows, so that it runs the
+// same cycle as the table.
+unsigned SwitchSamples[NUMSTATES];
+
+void SignalSet(int n, enum PelicanSignal ps) {
+    lit[n] |= 1U << ps;
+}
+
+void SignalReset(int n, enum PelicanSignal ps) {
+    lit[n] &= ~(1U << ps);
+}
+
+void SignalWrite(int n, unsigned mask) {
+    lit[n] = mask;
+}
+
+void SignalCommit(int n) {
+}
+
+void SignalResetAll(int n) {
+    lit[n] = 0;
+}
+
+void SignalSafe(int n, uint32_t detected) {
+    lit[n] = 0;
+}
+
+unsigned Measure(int n) {
+    unsigned sum = 0;
+    int ps;
+
+    if (sample)
+        return sample;
+
+    for (ps = RED_S; ps <= WAIT_S; ps++)
+        if (lit[n] & (1U << ps))
+            sum = sum + LampCounts[ps];
+
+    return sum;
+}
+
+uint32_t SysTickNow(void) {
+    return 0;
+}
+
+volatile uint32_t ButtonTime[CROSSINGS];
+
+int ButtonTestReset(int n) {
+    int res = pressed[n];
+
+    pressed[n] = 0;
+    return res;
+}
+
+void ButtonClear(int n) {
+    pressed[n] = 0;
+}
+
+int ClockSetProfile(enum ClockProfile profile) {
+    return 0;
+}
+
+uint32_t StampNow(void) {
+    return 0;
+}
+
+void TraceRecord(unsigned type, unsigned state, uint32_t value) {
+}
+
+#if CALIB_CACHE
+void CalibStore(struct Crossing *c) {
+}
+
+void CalibDrop(struct Crossing *c) {
+}
+#else
+void CalibBoot(struct Crossing *c, int warm) {
+}
+#endif
+
+// -----------------------------------
+// Benchmark
+// -----------------------------------
+
+static double now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// The table engine on crossing 0, as an engine for bench().
+static int table(int curr_state) {
+    executeSTM(&Crossings[0]);
+    return Crossings[0].state;
+}
+
+// Time stamp counter, in clocks of the PC, or 0 where there is none.
+static uint64_t now_clocks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Clocks taken by now_clocks() itself: the least of back to back reads.
+static uint64_t clocksOverhead(void) {
+    uint64_t least = ~(uint64_t) 0, t;
+    int i;
+
+    for (i = 0; i < 1000; i++) {
+        t = now_clocks();
+        t = now_clocks() - t;
+        if (t < least)
+            least = t;
+    }
+
+    return least;
+}
+
+// Run of one engine through the scenario: its state at the end, the states it
+// has been in, and a checksum of its transitions (state and frame), which is
+// the same for two engines only if they run the same sequence.
+struct Run {
+    int state;
+    unsigned visited;
+    uint32_t trace;
+};
+
+// Frames of each number of clocks, the last for HISTOGRAM and more.
+static long histogram[HISTOGRAM];
+
+// Run 'frames' frames of one engine and print the time per frame, in clocks
+// of the PC and in ns. 'samples' gives Measure() in each state, or NULL for
+// the lamps that are on. The median is not moved by the frames in which the
+// PC took an interrupt, which set the worst time.
+static struct Run bench(const char *name, int (*engine)(int),
+        const unsigned *samples, long frames) {
+    struct Run run = {REDINIT, 1U << REDINIT, 0};
+    uint64_t start, t, worst = 0, total = 0, overhead = clocksOverhead();
+    uint64_t clocks = now_clocks();
+    double ns = now_ns();
+    int prev, median;
+    long f;
+
+    for (median = 0; median < HISTOGRAM; median++)
+        histogram[median] = 0;
+
+    lit[0] = 0;
+    pressed[0] = 0;
+
+    for (f = 0; f < frames; f++) {
+        if (f % PRESS_PERIOD == 200)
+            pressed[0] = 1;
+        sample = (samples != NULL) ? samples[run.state] : 0;
+        prev = run.state;
+
+        start = now_clocks();
+        run.state = engine(run.state);
+        t = now_clocks() - start;
+
+        t = (t > overhead) ? t - overhead : 0;
+        total = total + t;
+        if (t > worst)
+            worst = t;
+        histogram[(t < HISTOGRAM) ? t : HISTOGRAM - 1]++;
+
+        if (run.state != prev)
+            run.trace = (run.trace ^ (uint32_t) (f << 5 | run.state)) *
+                16777619u;
+        run.visited |= 1U << run.state;
+    }
+    // Clocks of the PC per ns, for the time per frame.
+    ns = (now_clocks() - clocks) / (now_ns() - ns);
+    sample = 0;
+
+    for (median = 0, f = 0; median < HISTOGRAM - 1; median++) {
+        f = f + histogram[median];
+        if (2 * f >= frames)
+            break;
+    }
+
+    printf("%-8s %6.1f clocks/frame mean %4d median %8llu worst "
+            "%6.1f ns/frame  final state %2d  visited 0x%05x  trace 0x%08x\n",
+            name, (double) total / frames, median, (unsigned long long) worst,
+            (ns > 0) ? total / ns / frames : 0, run.state, run.visited,
+            (unsigned) run.trace);
+
+    return run;
+}
+
+// Fill SwitchSamples with readings inside the windows of the switch engine:
+// GREEN or WALK on its own, 2.5% up, and GREEN and WAIT, 10% of the lit
+// lamps down.
+static void switchSamples(void) {
+    unsigned green = LampCounts[GREEN_S], wait = LampCounts[WAIT_S];
+    unsigned dontWalk = LampCounts[DONTWALK_S], walk = LampCounts[WALK_S];
+
+    SwitchSamples[GREENON] = green + (green + dontWalk) / 40;
+    SwitchSamples[WAITON] = green + wait - (green + dontWalk + wait) / 10;
+    SwitchSamples[WALKON] = walk + (LampCounts[RED_S] + walk) / 40;
+}
+
+// Next sample for MEASURE_OUTPUTS, with up to MEASURE_NOISE percent error.
+static unsigned nextSample(uint32_t *seed, unsigned expected) {
+    *seed = *seed * 1103515245u + 12345u;
+
+    return expected * (100 - MEASURE_NOISE + (*seed >> 16) %
+            (2 * MEASURE_NOISE + 1)) / 100;
+}
+
+// One frame of the integer sampler: 1 if the reading fails the check.
+static int measureInt(void) {
+    struct Crossing *c = &Crossings[0];
+
+    return samplerUpdate(c, MEASURE_STATE) &&
+        outOfWindow(c, c->measuredProbe, MEASURE_STATE);
+}
+
+// One frame of the float batch: 1 if the reading fails the check.
+static int measureFloat(int counter) {
+    float volt = voltMeasurementFloat(counter, T4);
+
+    return counter > 1 &&
+        outOfWindowFloat(StmTable[MEASURE_STATE].outputs, volt);
+}
+
+// Run 'frames' frames of both measurement paths on noisy samples and print
+// the time per frame and the frames that fail the check; then the frames
+// from RED failing to its detection, over every frame of failure up to
+// STEP_FRAMES.
+static void benchMeasure(long frames) {
+    unsigned expected = 0;
+    long f, tripsInt = 0, tripsFloat = 0;
+    long sumInt = 0, sumFloat = 0, maxInt = 0, maxFloat = 0;
+    double start, timeInt, timeFloat;
+    uint32_t seed;
+    int ps, step;
+
+    for (ps = RED_S; ps <= WAIT_S; ps++) {
+        Crossings[0].calibrated[ps] = LampCounts[ps] * PROBE_SCALE;
+        voltagesFloat[ps] = 3.3f * LampCounts[ps] / ADCRANGE;
+        if (StmTable[MEASURE_STATE].outputs & SIG(ps))
+            expected = expected + LampCounts[ps];
+    }
+    StmLimitsBuild(&Crossings[0]);
+
+    seed = 1;
+    samplerReset(&Crossings[0], MEASURE_STATE);
+    start = now_ns();
+    for (f = 0; f < frames; f++) {
+        sample = nextSample(&seed, expected);
+        tripsInt = tripsInt + measureInt();
+    }
+    timeInt = now_ns() - start;
+
+    seed = 1;
+    start = now_ns();
+    for (f = 0; f < frames; f++) {
+        sample = nextSample(&seed, expected);
+        tripsFloat = tripsFloat + measureFloat(f % (CYCLESPERSEC * T4));
+    }
+    timeFloat = now_ns() - start;
+
+    printf("measure  integer %6.1f ns/frame  float %6.1f ns/frame  "
+            "out of window %ld / %ld (noise %d%%)\n", timeInt / frames,
+            timeFloat / frames, tripsInt, tripsFloat, MEASURE_NOISE);
+
+    // Step: RED fails at frame 'step' of the state.
+    for (step = 1; step < STEP_FRAMES; step++) {
+        long detInt = -1, detFloat = -1;
+
+        samplerReset(&Crossings[0], MEASURE_STATE);
+        for (f = 0; f < STEP_FRAMES + 10 && (detInt < 0 || detFloat < 0);
+                f++) {
+            sample = expected - ((f >= step) ? LampCounts[RED_S] : 0);
+            if (measureInt() && detInt < 0)
+                detInt = f - step;
+            if (measureFloat(f) && detFloat < 0)
+                detFloat = f - step;
+        }
+
+        sumInt = sumInt + detInt;
+        sumFloat = sumFloat + detFloat;
+        if (detInt > maxInt)
+            maxInt = detInt;
+        if (detFloat > maxFloat)
+            maxFloat = detFloat;
+    }
+
+    printf("step     integer %4.2f frames mean %ld max  "
+            "float %4.2f frames mean %ld max (window %d, %s)\n",
+            (double) sumInt / (STEP_FRAMES - 1), maxInt,
+            (double) sumFloat / (STEP_FRAMES - 1), maxFloat,
+            StmTable[MEASURE_STATE].window,
+            (SAMPLER_FILTER == SAMPLER_MEDIAN) ? "median" : "mean");
+
+    sample = 0;
+}
+
+// Run 'frames' frames of 'n' crossings and print the time per frame. Each
+// crossing has its presses PRESS_OFFSET frames after the one before, so that
+// the crossings are in different states.
+static void benchCrossings(int n, long frames) {
+    double start, t, worst = 0, total = 0;
+    long f;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        CrossingInit(&Crossings[i], i);
+        lit[i] = 0;
+        pressed[i] = 0;
+    }
+
+    for (f = 0; f < frames; f++) {
+        for (i = 0; i < n; i++)
+            if ((f + PRESS_OFFSET * i) % PRESS_PERIOD == 200)
+                pressed[i] = 1;
+
+        start = now_ns();
+        executeFrame(Crossings, n);
+        t = now_ns() - start;
+
+        total = total + t;
+        if (t > worst)
+            worst = t;
+    }
+
+    printf("crossings %2d %8.1f ns/frame mean %10.1f ns worst "
+            "%8.1f ns/crossing\n", n, total / frames, worst,
+            total / frames / n);
+}
+
+int main(int argc, char *argv[]) {
+    long frames = (argc > 1) ? atol(argv[1]) : 1000000;
+    struct Run table_run, switch_run;
+    int n;
+
+    CrossingInit(&Crossings[0], 0);
+    table_run = bench("table", table, NULL, frames);
+
+    switchSamples();
+    resetSTMSwitch();
+    switch_run = bench("switch", executeSTMSwitch, SwitchSamples, frames);
+
+    if (table_run.state != switch_run.state ||
+            table_run.visited != switch_run.visited ||
+            table_run.trace != switch_run.trace)
+        printf("table and switch ran different state sequences\n");
+
+    benchMeasure(frames);
+
+    for (n = 1; n <= CROSSINGS; n <<= 1)
+        benchCrossings(n, frames);
+
+    return 0;
+}
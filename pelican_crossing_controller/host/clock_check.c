@@ -0,0 +1,94 @@
+/* -------------------------------------
+ * Check that SysTickNow() never goes back across a clock switch.
+ *
+ * ClockSetProfile() restarts SysTick at the new core clock, and SysTickNow()
+ * must carry on from the time it had reached: the idle statistics, the press
+ * latencies and the scheduler deadlines take differences of it across the
+ * switches of every GREENON. This tool runs PelicanConfig() on the
+ * simulator of sim.c and switches between every pair of clock profiles. For
+ * each switch it reads SysTickNow() before it, just after it and after each
+ * of the next CHECK_TICKS ticks, and reports a reading below the one before.
+ *
+ * Build and run from this directory (main.c is not linked; this file runs
+ * the configuration itself):
+ *
+ *   gcc -O2 -I. -I../include -o clock_check clock_check.c sim.c \
+ *       registers.c ../src/pelican.c ../src/stm.c ../src/sched.c \
+ *       ../src/trace.c ../src/calib.c
+ *   ./clock_check
+ *
+ * It prints each switch, with the time it reads after it and after the next
+ * tick, in core clocks from the reading before it, and exits with 1 if any
+ * reading went back.
+ * -------------------------------------
+ */
+
+#include <stdio.h>
+#include "MKL25Z4.H"
+#include "pelican.h"
+#include "sim.h"
+
+#define CHECK_TICKS (3) // Ticks read after each switch.
+
+int failures = 0;
+
+// Reads SysTickNow() and reports it if it is below 'last'.
+static uint32_t check(const char *when, enum ClockProfile from,
+        enum ClockProfile to, uint32_t last) {
+    uint32_t now = SysTickNow();
+
+    // The difference, as the firmware takes it, is negative if time went
+    // back.
+    if ((int32_t) (now - last) < 0) {
+        printf("%s -> %s: %s, %ld clocks back\n", SimClockNames[from],
+                SimClockNames[to], when, (long) (int32_t) (last - now));
+        failures++;
+    }
+
+    return now;
+}
+
+// Entry point of the run: every switch from every profile.
+static int run(void) {
+    enum ClockProfile from, to;
+    uint32_t before, after, next, last;
+    int i;
+
+    PelicanConfig();
+
+    for (from = 0; from < CLOCK_PROFILES; from++)
+        for (to = 0; to < CLOCK_PROFILES; to++) {
+            if (to == from)
+                continue;
+
+            ClockSetProfile(from);
+            __WFI();
+
+            before = SysTickNow();
+            ClockSetProfile(to);
+            after = check("just after", from, to, before);
+
+            last = after;
+            for (i = 0; i < CHECK_TICKS; i++) {
+                __WFI();
+                last = check("after a tick", from, to, last);
+                if (i == 0)
+                    next = last;
+            }
+
+            printf("%-10s -> %-10s after %+9ld  next tick %+9ld\n",
+                    SimClockNames[from], SimClockNames[to],
+                    (long) (int32_t) (after - before),
+                    (long) (int32_t) (next - before));
+        }
+
+    return 0;
+}
+
+int main(void) {
+    SimReset(1);
+    SimRun(run, 1000000);
+
+    printf("%s\n", (failures) ? "SysTickNow() went back" : "ok");
+    return failures != 0;
+}
@@ -0,0 +1,440 @@
+/* -------------------------------------
+ * Fault-injection campaign.
+ *
+ * Measures how long the firmware takes to notice a lamp failure, against the
+ * 100 ms of the requirements. The unmodified firmware runs on the simulator
+ * of sim.c through initiation and one crossing cycle. At every frame of
+ * every state visited, the run is forked once per fault: an open or a short
+ * on each of the six signals. Each child injects its fault and runs on until
+ * the STM reacts (redFailure or amberFailure of crossing 0 is set), then
+ * reports for how long the faulty lamp had been on: a lamp that is off
+ * cannot be checked.
+ *
+ * Forking at the injection point gives each scenario the exact firmware and
+ * register state of the fault-free run, without replaying the cycle up to
+ * it, and spreads the scenarios over all cores.
+ *
+ * Build and run from this directory:
+ *
+ *   gcc -O2 -Dmain=firmware_main -I. -I../include -o fault_campaign \
+ *       fault_campaign.c sim.c registers.c ../src/main.c ../src/pelican.c \
+ *       ../src/stm.c ../src/sched.c ../src/trace.c ../src/calib.c
+ *   ./fault_campaign [-j jobs] [-s stride] [-p phase] [-n noise] [-o csv]
+ *
+ *   -j  scenarios run in parallel (default: number of cores)
+ *   -s  inject at every 'stride'th frame of each state (default 1)
+ *   -p  ticks into the frame at which the fault occurs (default 0)
+ *   -n  peak ADC noise in counts (default 0)
+ *   -o  write every scenario to a CSV file
+ * -------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "MKL25Z4.H"
+#include "pelican.h"
+#include "stm.h"
+#include "sim.h"
+
+// The firmware is built with -Dmain=firmware_main; this file keeps main().
+#undef main
+
+#define START_PRESS (8000)     // Press that ends initiation, in ms.
+#define GREEN_HOLD (35000)     // GREENON time before the crossing press, ms.
+#define DEADLINE (100)         // Required detection time, in ms.
+#define MISS_TIMEOUT (5000)    // Time with the faulty lamp on to give up, ms.
+#define RUN_TIMEOUT (300000)   // Time from injection to give up, in ms.
+#define HIST_BIN (10)          // Width of a histogram bin, in ms.
+#define HIST_BINS (20)         // Bins; the last also counts longer latencies.
+
+extern int firmware_main(void);
+
+// The crossing under test; with CROSSINGS > 1 the others run fault-free.
+static struct Crossing *const crossing = &Crossings[0];
+
+// Outcome of a scenario.
+//   DETECTED: the STM reacted after the faulty lamp was on.
+//   MISSED: the lamp was on for MISS_TIMEOUT in all, or on at some point
+//     within RUN_TIMEOUT, without a reaction.
+//   UNUSED: the lamp was not turned on within RUN_TIMEOUT.
+//   FALSE_TRIP: the STM reacted before the faulty lamp was on.
+enum Outcome {DETECTED, MISSED, UNUSED, FALSE_TRIP, OUTCOMES};
+
+const char *const outcomeNames[OUTCOMES] = {
+    "detected", "missed", "unused", "false"
+};
+
+// Result of a scenario, written by the child to the results pipe.
+struct Result {
+    uint8_t state;     // State at injection.
+    uint8_t signal;    // Faulty signal.
+    uint8_t fault;     // enum SimFault.
+    uint8_t outcome;   // enum Outcome.
+    uint8_t amber;     // Reaction was the AMBER one.
+    uint16_t frame;    // Frame of the state at injection.
+    uint32_t latency;  // Time the lamp was on before the reaction, in ms.
+};
+
+// Options.
+int jobs = 0;
+int stride = 1;
+int phase = 0;
+const char *csvName = 0;
+
+// Run state, shared by the driver and (after the fork) the children.
+int curState = -1;
+uint64_t entryTime = 0;
+unsigned statesDone = 0; // States whose first visit has ended.
+int child = 0;
+
+// Child only.
+struct Result result;
+uint64_t injectTime = 0;
+uint64_t lampTime = 0; // Last tick at which the faulty lamp was seen on.
+uint64_t lampOn = 0;   // Ticks with the faulty lamp on.
+
+// Driver only.
+int pipeFds[2];
+int running = 0;
+struct Result *results = 0;
+int numResults = 0;
+int maxResults = 0;
+
+// -----------------------------------
+// Results
+// -----------------------------------
+
+// Read the results available in the pipe; block for one if 'wait' is set.
+static void collect(int wait) {
+    struct Result r;
+    ssize_t n;
+
+    fcntl(pipeFds[0], F_SETFL, (wait) ? 0 : O_NONBLOCK);
+
+    while ((n = read(pipeFds[0], &r, sizeof r)) == (ssize_t) sizeof r) {
+        if (numResults == maxResults) {
+            maxResults = (maxResults) ? 2 * maxResults : 4096;
+            results = realloc(results, maxResults * sizeof *results);
+            if (results == 0) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+
+        results[numResults++] = r;
+        fcntl(pipeFds[0], F_SETFL, O_NONBLOCK);
+    }
+
+    if (n < 0 && errno != EAGAIN) {
+        perror("read");
+        exit(1);
+    }
+}
+
+// Wait for one child to end and take its result.
+static void reap(void) {
+    int status;
+
+    if (wait(&status) < 0) {
+        perror("wait");
+        exit(1);
+    }
+
+    running--;
+    collect(0);
+}
+
+// -----------------------------------
+// Scenarios
+// -----------------------------------
+
+// End the child with its result.
+static void finish(enum Outcome outcome) {
+    result.outcome = outcome;
+    result.amber = (crossing->amberFailure != 0);
+    result.latency = (outcome == DETECTED) ? (uint32_t) lampOn : 0;
+
+    if (write(pipeFds[1], &result, sizeof result) != (ssize_t) sizeof result)
+        _exit(1);
+    _exit(0);
+}
+
+// Child: watch for the reaction to the fault.
+static void scenarioTick(void) {
+    if (crossing->redFailure || crossing->amberFailure)
+        finish((lampTime) ? DETECTED : FALSE_TRIP);
+
+    // A lamp that goes off before the fault is noticed may only be checked
+    // again in the next cycle, so only the time it is on is counted.
+    if (SimOutputs(0) & SIG(result.signal)) {
+        lampTime = SimTime;
+        lampOn++;
+    }
+
+    if (lampOn >= MISS_TIMEOUT)
+        finish(MISSED);
+
+    if (SimTime - injectTime >= RUN_TIMEOUT)
+        finish((lampTime) ? MISSED : UNUSED);
+}
+
+// Driver: fork one child per fault at this tick.
+static void inject(int frame) {
+    int ps, fault;
+    pid_t pid;
+
+    for (ps = RED_S; ps <= WAIT_S; ps++) {
+        for (fault = SIM_OPEN; fault <= SIM_SHORT; fault++) {
+            while (running >= jobs)
+                reap();
+
+            pid = fork();
+            if (pid < 0) {
+                perror("fork");
+                exit(1);
+            }
+
+            if (pid == 0) {
+                close(pipeFds[0]);
+                child = 1;
+                result.state = curState;
+                result.signal = ps;
+                result.fault = fault;
+                result.frame = frame;
+                injectTime = SimTime;
+                SimSetFault(0, ps, (enum SimFault) fault);
+                scenarioTick(); // The lamp may already be on.
+                return;
+            }
+
+            running++;
+            collect(0);
+        }
+    }
+}
+
+// Called at every tick, in the driver and in the children.
+static void tick(void) {
+    int s = crossing->state;
+    uint64_t elapsed;
+
+    if (s != curState) {
+        if (curState >= 0)
+            statesDone |= 1U << curState;
+        curState = s;
+        entryTime = SimTime;
+    }
+    elapsed = SimTime - entryTime;
+
+    // Button presses: end initiation, and cross after GREEN_HOLD.
+    if (SimTime == START_PRESS || (s == GREENON && elapsed == GREEN_HOLD))
+        SimButton(0);
+
+    if (child) {
+        scenarioTick();
+        return;
+    }
+
+    if (crossing->redFailure || crossing->amberFailure) {
+        fprintf(stderr, "fault-free run tripped in %s\n", SimStateNames[s]);
+        exit(1);
+    }
+
+    // Every state of the cycle has been visited once.
+    if (statesDone & (1U << DONTWALKON))
+        longjmp(SimExit, 1);
+
+    if (!(statesDone & (1U << s)) && elapsed % CYCLESYSTICK == (unsigned) phase
+            && (elapsed / CYCLESYSTICK) % stride == 0)
+        inject(elapsed / CYCLESYSTICK);
+}
+
+// -----------------------------------
+// Report
+// -----------------------------------
+
+static int compareLatency(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+// Print one line of counts and latency percentiles for the results that
+// match a state (or -1), a signal (or -1) and a fault (or -1).
+static void reportLine(const char *name, int st, int ps, int fault) {
+    uint32_t *lat = malloc((numResults + 1) * sizeof *lat);
+    unsigned counts[OUTCOMES] = {0};
+    unsigned total = 0, wrong = 0, late = 0, n = 0;
+    int i;
+
+    for (i = 0; i < numResults; i++) {
+        struct Result *r = &results[i];
+
+        if ((st >= 0 && r->state != st) || (ps >= 0 && r->signal != ps)
+                || (fault >= 0 && r->fault != fault))
+            continue;
+
+        total++;
+        counts[r->outcome]++;
+        if (r->outcome != DETECTED)
+            continue;
+
+        lat[n++] = r->latency;
+        if (r->latency > DEADLINE)
+            late++;
+        if (r->amber != (r->signal == AMBER_S))
+            wrong++;
+    }
+
+    if (total == 0) {
+        free(lat);
+        return;
+    }
+
+    printf("%-22s %6u %6u %6u %6u %6u %6u", name, total, counts[DETECTED],
+            counts[MISSED], counts[UNUSED], counts[FALSE_TRIP], wrong);
+
+    if (n) {
+        qsort(lat, n, sizeof *lat, compareLatency);
+        printf(" %5u %5u %5u %5u %6u\n", lat[0], lat[n / 2],
+                lat[(n * 95) / 100], lat[n - 1], late);
+    } else {
+        printf(" %5s %5s %5s %5s %6s\n", "-", "-", "-", "-", "-");
+    }
+
+    free(lat);
+}
+
+static void reportHeader(const char *first) {
+    printf("%-22s %6s %6s %6s %6s %6s %6s %5s %5s %5s %5s %6s\n", first,
+            "scen", "det", "miss", "unused", "false", "wrong", "min", "p50",
+            "p95", "max", ">100");
+}
+
+static void report(double seconds) {
+    unsigned hist[HIST_BINS] = {0};
+    char name[32];
+    int i, ps, fault, max = 1;
+
+    printf("%d scenarios, %d jobs, %.1f s, fault at tick %d of the frame, "
+            "noise %u\n\n", numResults, jobs, seconds, phase, SimNoise);
+
+    reportHeader("fault");
+    for (ps = RED_S; ps <= WAIT_S; ps++) {
+        for (fault = SIM_OPEN; fault <= SIM_SHORT; fault++) {
+            sprintf(name, "%s %s", SimSignalNames[ps], SimFaultNames[fault]);
+            reportLine(name, -1, ps, fault);
+        }
+    }
+    reportLine("all", -1, -1, -1);
+
+    printf("\n");
+    reportHeader("state at injection");
+    for (i = 0; i < NUMSTATES; i++)
+        reportLine(SimStateNames[i], i, -1, -1);
+
+    // Distribution of the detection latencies.
+    for (i = 0; i < numResults; i++) {
+        if (results[i].outcome == DETECTED) {
+            int bin = results[i].latency / HIST_BIN;
+
+            hist[(bin < HIST_BINS) ? bin : HIST_BINS - 1]++;
+        }
+    }
+    for (i = 0; i < HIST_BINS; i++)
+        if (hist[i] > (unsigned) max)
+            max = hist[i];
+
+    printf("\ndetection latency (ms)\n");
+    for (i = 0; i < HIST_BINS; i++) {
+        printf("%4d%s %6u |%.*s\n", i * HIST_BIN,
+                (i == HIST_BINS - 1) ? "+" : " ", hist[i],
+                (int) ((hist[i] * 50 + max - 1) / max),
+                "##################################################");
+    }
+
+    printf("\nlatency: time the faulty lamp was on before the reaction\n"
+            "unused: the lamp was not on within %d s of the fault\n"
+            "wrong: AMBER reaction to a fault of another lamp, or the reverse"
+            "\n", RUN_TIMEOUT / 1000);
+}
+
+static void writeCsv(const char *name) {
+    FILE *f = fopen(name, "w");
+    int i;
+
+    if (f == 0) {
+        perror(name);
+        exit(1);
+    }
+
+    fprintf(f, "state,frame,signal,fault,outcome,reaction,latency_ms\n");
+    for (i = 0; i < numResults; i++) {
+        struct Result *r = &results[i];
+
+        fprintf(f, "%s,%u,%s,%s,%s,%s,%u\n", SimStateNames[r->state],
+                r->frame, SimSignalNames[r->signal], SimFaultNames[r->fault],
+                outcomeNames[r->outcome], (r->amber) ? "amber" : "red",
+                r->latency);
+    }
+
+    fclose(f);
+}
+
+int main(int argc, char *argv[]) {
+    struct timespec start, end;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "j:s:p:n:o:")) != -1) {
+        switch (opt) {
+            case 'j': jobs = atoi(optarg); break;
+            case 's': stride = atoi(optarg); break;
+            case 'p': phase = atoi(optarg); break;
+            case 'n': SimNoise = atoi(optarg); break;
+            case 'o': csvName = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-j jobs] [-s stride] [-p phase] "
+                        "[-n noise] [-o csv]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (jobs <= 0)
+        jobs = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (jobs <= 0)
+        jobs = 1;
+    if (stride <= 0)
+        stride = 1;
+    phase = phase % CYCLESYSTICK;
+
+    if (pipe(pipeFds) < 0) {
+        perror("pipe");
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    fflush(stdout);
+    SimReset(1);
+    SimTickHook = tick;
+    SimRun(firmware_main, UINT64_MAX);
+
+    while (running > 0)
+        reap();
+    close(pipeFds[1]);
+    collect(1);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    report((end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    if (csvName)
+        writeCsv(csvName);
+
+    return 0;
+}
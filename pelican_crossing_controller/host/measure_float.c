@@ -0,0 +1,80 @@
+#include <MKL25Z4.H>
+#include "pelican.h"
+
+/* -------------------------------------
+ * The float measurement path that the integer probe readings of stm.c
+ * replaced, kept for bench_stm.c only.
+ *
+ * volt_measurement(), expectedVoltage() and the window check as they were,
+ * renamed so that they link next to stm.c. The cycle counter is passed in,
+ * and the probe is that of crossing 0.
+ * -------------------------------------
+ */
+
+#define Measure() Measure(0)
+
+#define MCYCLES (5) // Number of ADC measurements.
+#define VREF (3.3) // Reference voltage.
+#define HIGHTHRESHOLD (0.7) // Threshold sensed voltage.
+#define LOWTHRESHOLD (0.7)  // Threshold sensed voltage.
+#define TOLERANCE (0.05) // Allowed error on the expected voltage (+/- 5%).
+
+// ---- Debugging only ------------
+#define RED_LED_POS (18) // On port B.
+#define GREEN_LED_POS (19)  // On port B.
+// ---- End debugging only ------------
+
+static volatile float measured_voltage; // Scaled value.
+static volatile unsigned res[MCYCLES]; // Raw values.
+static volatile int ac;
+volatile float voltagesFloat[6];
+
+float voltMeasurementFloat(int cycleCounter, int time) {
+    // Ignores first incorrect measurement.
+    if (cycleCounter == 0) {
+        measured_voltage = 0;
+        return 0;
+    }
+
+    ac = (cycleCounter - 1) % MCYCLES;
+
+    // Prevents last cycle from being measured.
+    if (ac <= MCYCLES && cycleCounter < CYCLESPERSEC * time) {
+        res[ac] = Measure();
+        measured_voltage = (VREF * res[ac]) / ADCRANGE;
+    }
+
+    // Calculates average each five cycles.
+    if (ac == MCYCLES - 1) {
+        unsigned sum = 0;
+        int i;
+
+        for (i=0; i < MCYCLES; i++)
+            sum = sum + res[i];
+
+        measured_voltage = (VREF * sum) / (MCYCLES * ADCRANGE);
+
+        // Turn on GREEN LED for low voltage and RED for high.
+        PTB->PSOR |= MASK(RED_LED_POS) | MASK(GREEN_LED_POS);
+
+        if (measured_voltage >= HIGHTHRESHOLD)
+            PTB->PCOR |= MASK(RED_LED_POS);
+        else if (measured_voltage < LOWTHRESHOLD)
+            PTB->PCOR |= MASK(GREEN_LED_POS);
+    }
+
+    return measured_voltage;
+}
+
+// Returns 1 if 'volt' is outside the window for the lamps in 'outputs'.
+int outOfWindowFloat(unsigned outputs, float volt) {
+    float expected = 0;
+    int ps;
+
+    for (ps = RED_S; ps <= WAIT_S; ps++)
+        if (outputs & (1U << ps))
+            expected = expected + voltagesFloat[ps];
+
+    return (volt > expected * (1 + TOLERANCE)) ||
+        (volt < expected * (1 - TOLERANCE));
+}
@@ -0,0 +1,402 @@
+/* -------------------------------------
+ * Host simulation of the controller.
+ *
+ * Runs the firmware (main.c, pelican.c, stm.c, sched.c, trace.c) on the
+ * peripheral simulator of sim.c, driven by a script of button presses and
+ * lamp faults, and prints a timeline of the outputs and a summary of the
+ * time spent in each state. Virtual time is not tied to the wall clock: a
+ * day of operation runs in seconds.
+ *
+ * Build and run from this directory:
+ *
+ *   gcc -O2 -Dmain=firmware_main -I. -I../include -o pelican_sim \
+ *       pelican_sim.c sim.c registers.c vcd.c trace_read.c ../src/main.c \
+ *       ../src/pelican.c ../src/stm.c ../src/sched.c ../src/trace.c \
+ *       ../src/calib.c
+ *   ./pelican_sim [-q] [-t trace] [-v vcd [-c]] [-f flash] [script]
+ *
+ * The script is read from standard input if no file is given. One command
+ * per line, times in seconds, '#' starts a comment:
+ *
+ *   press <t>                         press the button at t
+ *   presses <t> <period> <count>      press 'count' times from t
+ *   hold <t>                          hold the button from reset until t
+ *   fault <signal> <ok|open|short> <t>  set the fault of a lamp at t
+ *   crossing <n>                      crossing of the commands that follow
+ *   noise <counts>                    peak ADC noise
+ *   seed <n>                          seed of the noise
+ *   end <t>                           end of the run (default 600 s)
+ *
+ * Signals are red, amber, green, dontwalk, walk and wait. With -q only the
+ * summary is printed. With -t the bytes sent by UART0, the trace of the
+ * firmware, are written to a file, for trace_decode. With -v the signals,
+ * the button, the state and the probe voltage are written to a VCD file at
+ * each change; -c adds SysTickCounter, which changes at every tick.
+ *
+ * With -f the flash of the board is read from a file before the run, if it
+ * exists, and written back after it: the first run calibrates the lamps and
+ * leaves the cache in the file, and the next ones boot warm from it, as
+ * after a reset of the board. The summary gives the time from reset to
+ * operation of each crossing. A 'hold' keeps the button down through the
+ * boot, which makes the crossing calibrate again instead.
+ *
+ * With the firmware built for more than one crossing (CROSSINGS), presses
+ * and faults go to crossing 0 unless a 'crossing' command comes first, the
+ * timeline gives the crossing of each line and the summary has the states of
+ * each crossing. The VCD file has crossing 0.
+ * -------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "MKL25Z4.H"
+#include "pelican.h"
+#include "stm.h"
+#include "sched.h"
+#include "trace.h"
+#include "calib.h"
+#include "sim.h"
+#include "vcd.h"
+
+// The firmware is built with -Dmain=firmware_main; this file keeps main().
+#undef main
+
+#define MAX_EVENTS (100000) // Scripted events.
+
+extern int firmware_main(void);
+extern volatile int SysTickCounter;
+
+// A scripted event.
+struct Event {
+    uint64_t time;     // In ms.
+    int crossing;
+    int signal;        // -1 for a button press, -2 for its release.
+    enum SimFault fault;
+};
+
+struct Event events[MAX_EVENTS];
+int numEvents = 0;
+int nextEvent = 0;
+
+uint64_t endTime = 600000;
+uint32_t seed = 1;
+int quiet = 0;
+const char *flashName = 0; // With -f.
+unsigned held = 0;         // Buttons held at reset, one bit each.
+
+// Timeline and summary, per crossing.
+int lastState[CROSSINGS];
+unsigned lastOutputs[CROSSINGS];
+uint64_t stateTicks[CROSSINGS][NUMSTATES];
+uint32_t stateEntries[CROSSINGS][NUMSTATES];
+uint32_t presses = 0;
+
+// Waveforms, with -v.
+FILE *vcdFile = 0;
+struct VcdWriter vcd;
+int vcdCounter = 0;
+uint64_t lastPress = 0;
+
+// -----------------------------------
+// Script
+// -----------------------------------
+
+static int compareEvents(const void *a, const void *b) {
+    const struct Event *x = a, *y = b;
+
+    return (x->time > y->time) - (x->time < y->time);
+}
+
+static void addEvent(double t, int crossing, int signal,
+        enum SimFault fault) {
+    if (numEvents == MAX_EVENTS) {
+        fprintf(stderr, "too many events\n");
+        exit(1);
+    }
+
+    events[numEvents].time = (uint64_t) (t * 1000 + 0.5);
+    events[numEvents].crossing = crossing;
+    events[numEvents].signal = signal;
+    events[numEvents].fault = fault;
+    numEvents++;
+}
+
+static int lookup(const char *name, const char *const *names, int n) {
+    int i;
+
+    for (i = 0; i < n; i++)
+        if (strcmp(name, names[i]) == 0)
+            return i;
+
+    return -1;
+}
+
+static void readScript(FILE *f) {
+    char line[256], cmd[32], a[32], b[32];
+    double t, period;
+    int line_no = 0, count, i, signal, fault, crossing = 0;
+
+    while (fgets(line, sizeof line, f)) {
+        line_no++;
+        if (strchr(line, '#'))
+            *strchr(line, '#') = '\0';
+
+        if (sscanf(line, "%31s", cmd) != 1)
+            continue;
+
+        if (strcmp(cmd, "press") == 0 && sscanf(line, "%*s %lf", &t) == 1) {
+            addEvent(t, crossing, -1, SIM_OK);
+        } else if (strcmp(cmd, "presses") == 0
+                && sscanf(line, "%*s %lf %lf %d", &t, &period, &count) == 3) {
+            for (i = 0; i < count; i++)
+                addEvent(t + i * period, crossing, -1, SIM_OK);
+        } else if (strcmp(cmd, "hold") == 0
+                && sscanf(line, "%*s %lf", &t) == 1) {
+            held |= 1U << crossing;
+            addEvent(t, crossing, -2, SIM_OK);
+        } else if (strcmp(cmd, "fault") == 0
+                && sscanf(line, "%*s %31s %31s %lf", a, b, &t) == 3
+                && (signal = lookup(a, SimSignalNames, 6)) >= 0
+                && (fault = lookup(b, SimFaultNames, 3)) >= 0) {
+            addEvent(t, crossing, signal, (enum SimFault) fault);
+        } else if (strcmp(cmd, "crossing") == 0
+                && sscanf(line, "%*s %d", &crossing) == 1
+                && crossing >= 0 && crossing < CROSSINGS) {
+        } else if (strcmp(cmd, "noise") == 0
+                && sscanf(line, "%*s %u", &SimNoise) == 1) {
+        } else if (strcmp(cmd, "seed") == 0
+                && sscanf(line, "%*s %u", &seed) == 1) {
+        } else if (strcmp(cmd, "end") == 0
+                && sscanf(line, "%*s %lf", &t) == 1) {
+            endTime = (uint64_t) (t * 1000 + 0.5);
+        } else {
+            fprintf(stderr, "line %d: bad command: %s", line_no, line);
+            exit(1);
+        }
+    }
+
+    qsort(events, numEvents, sizeof events[0], compareEvents);
+}
+
+// -----------------------------------
+// Run
+// -----------------------------------
+
+// Outputs as a fixed-width string, one letter per signal that is on.
+static const char *outputString(unsigned outputs) {
+    static char s[7];
+    int ps;
+
+    for (ps = 0; ps < 6; ps++)
+        s[ps] = (outputs & (1U << ps)) ? "RAGDWI"[ps] : '-';
+    s[6] = '\0';
+
+    return s;
+}
+
+// Crossing of a timeline line, when there are several.
+static const char *crossingLabel(int n) {
+    static char s[16];
+
+    if (CROSSINGS == 1)
+        return "";
+
+    snprintf(s, sizeof s, "%d ", n);
+    return s;
+}
+
+// Called at every tick: apply the events that are due, then record the state
+// and the outputs left by the previous tick.
+static void tick(void) {
+    unsigned outputs;
+    int n, s;
+
+    while (nextEvent < numEvents && events[nextEvent].time <= SimTime) {
+        struct Event *e = &events[nextEvent++];
+
+        if (e->signal == -2) {
+            SimButtonHold(e->crossing, 0);
+        } else if (e->signal < 0) {
+            SimButton(e->crossing);
+            presses++;
+            if (e->crossing == 0)
+                lastPress = SimTime;
+        } else {
+            SimSetFault(e->crossing, e->signal, e->fault);
+        }
+
+        if (!quiet)
+            printf("%10.3f  %s%-6s  %s %s\n", SimTime / 1000.0,
+                    crossingLabel(e->crossing), "",
+                    (e->signal == -2) ? "release" : (e->signal < 0)
+                    ? "press" : SimSignalNames[e->signal],
+                    (e->signal < 0) ? "" : SimFaultNames[e->fault]);
+    }
+
+    for (n = 0; n < CROSSINGS; n++) {
+        s = Crossings[n].state;
+        stateTicks[n][s]++;
+
+        if (s != lastState[n])
+            stateEntries[n][s]++;
+
+        outputs = SimOutputs(n);
+        if (!quiet && (s != lastState[n] || outputs != lastOutputs[n]))
+            printf("%10.3f  %s%s  %s\n", SimTime / 1000.0, crossingLabel(n),
+                    outputString(outputs), SimStateNames[s]);
+
+        lastState[n] = s;
+        lastOutputs[n] = outputs;
+    }
+
+    if (vcdFile) {
+        struct VcdValues values;
+
+        // The button is shown held for the debounce time.
+        values.outputs = lastOutputs[0];
+        values.button = presses != 0 && SimTime - lastPress < BUTTON_DELAY;
+        values.state = lastState[0];
+        values.counter = SysTickCounter;
+        values.probe = (double) SimProbe(0) * VREF_MV / ADCRANGE;
+        VcdWrite(&vcd, SimTime * 1000, &values);
+    }
+}
+
+// Print the events posted to a queue, the most queued at once and the events
+// lost to a full queue.
+static void printQueue(const char *name, struct SchedQueue *q) {
+    printf("%-22s %8u %12u %7u\n", name, q->head, q->peak, q->overflows);
+}
+
+// Print the time spent in each state by a crossing.
+static void printStates(int n) {
+    int i;
+
+    printf("%-22s %8s %12s %7s\n", "state", "entries", "time (s)", "share");
+    for (i = 0; i < NUMSTATES; i++)
+        if (stateTicks[n][i])
+            printf("%-22s %8u %12.3f %6.2f%%\n", SimStateNames[i],
+                    stateEntries[n][i], stateTicks[n][i] / 1000.0,
+                    100.0 * stateTicks[n][i] / SimTime);
+}
+
+int main(int argc, char *argv[]) {
+    FILE *f = stdin;
+    uint32_t crossings = 0, lost = 0;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-q") == 0) {
+            quiet = 1;
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            if ((SimUARTOut = fopen(argv[++i], "wb")) == 0) {
+                perror(argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-v") == 0 && i + 1 < argc) {
+            if ((vcdFile = fopen(argv[++i], "w")) == 0) {
+                perror(argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-c") == 0) {
+            vcdCounter = 1;
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            flashName = argv[++i];
+        } else if ((f = fopen(argv[i], "r")) == 0) {
+            perror(argv[i]);
+            return 1;
+        }
+    }
+
+    readScript(f);
+
+    for (i = 0; i < CROSSINGS; i++) {
+        lastState[i] = -1;
+        lastOutputs[i] = ~0U;
+    }
+
+    if (vcdFile)
+        VcdOpen(&vcd, vcdFile, "pelican_sim", vcdCounter);
+
+    SimReset(seed);
+    if (flashName && SimFlashLoad(flashName) < 0) {
+        fprintf(stderr, "%s: not a flash image\n", flashName);
+        return 1;
+    }
+    for (i = 0; i < CROSSINGS; i++)
+        if (held & (1U << i))
+            SimButtonHold(i, 1);
+
+    SimTickHook = tick;
+    SimRun(firmware_main, endTime);
+
+    if (flashName && SimFlashSave(flashName) < 0) {
+        perror(flashName);
+        return 1;
+    }
+
+    for (i = 0; i < CROSSINGS; i++) {
+        crossings += stateEntries[i][WALKON];
+        lost += ButtonQueue[i].overflows;
+    }
+
+    printf("\n%.3f s simulated, %u presses, %u crossings\n",
+            SimTime / 1000.0, presses, crossings);
+    for (i = 0; i < CROSSINGS; i++) {
+        if (CROSSINGS > 1)
+            printf("%scrossing %d\n", (i) ? "\n" : "", i);
+        printStates(i);
+    }
+
+    printf("\n");
+    for (i = 0; i < CROSSINGS; i++)
+        if (BootTime[i])
+            printf("boot %sto operation: %.3f ms, %s\n", crossingLabel(i),
+                    BootTime[i] / 1000.0,
+                    BootWarm[i] ? "from the cache" : "calibrated");
+        else
+            printf("boot %sto operation: not reached\n", crossingLabel(i));
+
+    printf("\n%-22s %8s %12s %7s\n", "clock", "", "time (s)", "share");
+    for (i = 0; i < CLOCK_PROFILES; i++)
+        if (ClockStats.ticks[i])
+            printf("%-22s %8s %12.3f %6.2f%%\n", SimClockNames[i], "",
+                    ClockStats.ticks[i] / 1000.0,
+                    100.0 * ClockStats.ticks[i] / SimTime);
+    printf("%u clock switches, %u failed ADC calibrations\n",
+            ClockStats.switches, ClockStats.calFailures);
+
+    if (ButtonLatency.count)
+        printf("\npress to WAIT: %u presses, min %.3f mean %.3f max %.3f ms, "
+                "%u lost\n", ButtonLatency.count, ButtonLatency.min / 1000.0,
+                ButtonLatency.sum / 1000.0 / ButtonLatency.count,
+                ButtonLatency.max / 1000.0, lost);
+
+    printf("\n%-22s %8s %12s %7s\n", "event queue", "posted", "peak", "lost");
+    for (i = 0; i < CROSSINGS; i++) {
+        char name[16];
+
+        snprintf(name, sizeof name, "button %s", crossingLabel(i));
+        printQueue((CROSSINGS == 1) ? "button" : name, &ButtonQueue[i]);
+    }
+    printQueue("timer", &SchedTimerQueue);
+#if ADC_SAMPLING == ADC_SAMPLING_WINDOW
+    printQueue("ADC", &ADCQueue);
+#endif
+
+#if TRACE
+    printf("\ntrace: %u bytes recorded, %llu sent, %u records lost\n",
+            TraceHead, (unsigned long long) SimUARTBytes, TraceLost);
+#endif
+
+    if (SimUARTOut)
+        fclose(SimUARTOut);
+
+    if (vcdFile) {
+        VcdEnd(&vcd, SimTime * 1000);
+        fclose(vcdFile);
+    }
+
+    return 0;
+}
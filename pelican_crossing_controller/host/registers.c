@@ -0,0 +1,118 @@
+#include "MKL25Z4.H"
+
+// -----------------------------------
+// Host register file: one instance of each peripheral used by the firmware.
+// -----------------------------------
+
+uint32_t SystemCoreClock = 48000000u;
+
+SIM_Type SIM_Host;
+MCG_Type MCG_Host;
+OSC_Type OSC0_Host;
+SMC_Type SMC_Host;
+SysTick_Type SysTick_Host;
+PORT_Type PORTA_Host, PORTB_Host, PORTD_Host, PORTE_Host;
+GPIO_Type PTB_Host, PTD_Host, PTE_Host;
+ADC_Type ADC0_Host;
+DMAMUX_Type DMAMUX0_Host;
+DMA_Type DMA0_Host;
+PIT_Type PIT_Host;
+TPM_Type TPM0_Host;
+UART0_Type UART0_Host;
+FTFA_Type FTFA_Host;
+
+// NVIC state, one bit per external interrupt.
+uint32_t NVIC_Enabled;
+uint32_t NVIC_Pending;
+
+void NVIC_EnableIRQ(IRQn_Type irq) {
+    if (irq >= 0)
+        NVIC_Enabled |= 1UL << irq;
+}
+
+void NVIC_DisableIRQ(IRQn_Type irq) {
+    if (irq >= 0)
+        NVIC_Enabled &= ~(1UL << irq);
+}
+
+void NVIC_ClearPendingIRQ(IRQn_Type irq) {
+    if (irq >= 0)
+        NVIC_Pending &= ~(1UL << irq);
+}
+
+void NVIC_SetPriority(IRQn_Type irq, uint32_t priority) {
+    (void) irq;
+    (void) priority;
+}
+
+// Same contract as the CMSIS function: 1 if the reload does not fit. The
+// counter is cleared, and reloads from LOAD on the next clock; code takes no
+// time in the model, so it reads LOAD, as after a tick.
+uint32_t SysTick_Config(uint32_t ticks) {
+    if ((ticks - 1) > SysTick_LOAD_RELOAD_Msk)
+        return 1;
+
+    SysTick->LOAD = ticks - 1;
+    SysTick->VAL = SysTick->LOAD;
+    SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_TICKINT_Msk |
+        SysTick_CTRL_ENABLE_Msk;
+    return 0;
+}
+
+// Status of the MCG and the SMC for their control registers, as reached once
+// the clocks have settled.
+void SimMCGStatus(void) {
+    uint8_t clks = MCG->C1 >> 6;
+    uint8_t s = 0;
+
+    if (MCG->C2 & MCG_C2_IRCS_MASK)
+        s |= 0x1u;     // IRCST: fast IRC.
+    if (MCG->C2 & MCG_C2_EREFS0_MASK)
+        s |= 0x2u;     // OSCINIT0: crystal running.
+    if (clks == 0 && (MCG->C6 & MCG_C6_PLLS_MASK))
+        clks = 3;      // CLKST: PLL output.
+    s |= clks << 2;
+    if (MCG->C1 & MCG_C1_IREFS_MASK)
+        s |= 0x10u;    // IREFST: FLL on the slow IRC.
+    if (MCG->C6 & MCG_C6_PLLS_MASK)
+        s |= 0x60u;    // PLLST and LOCK0.
+
+    *(uint8_t *) &MCG->S = s;
+
+    // PMSTAT: RUN (1) or, if allowed and asked for, VLPR (4).
+    *(uint8_t *) &SMC->PMSTAT = ((SMC->PMPROT & SMC_PMPROT_AVLP_MASK)
+            && (SMC->PMCTRL & SMC_PMCTRL_RUNM(3)) == SMC_PMCTRL_RUNM(2))
+        ? 0x04u : 0x01u;
+}
+
+// SystemCoreClockUpdate() for the 8 MHz crystal and the 32768 Hz and 4 MHz
+// internal references of the FRDM-KL25Z.
+void SystemCoreClockUpdate(void) {
+    uint32_t mcgout;
+
+    switch (MCG->C1 >> 6) {
+    case 0:
+        if (MCG->C6 & MCG_C6_PLLS_MASK)
+            mcgout = 8000000u / ((MCG->C5 & 0x1Fu) + 1) * ((MCG->C6 & 0x1Fu)
+                    + 24);
+        else if (MCG->C1 & MCG_C1_IREFS_MASK)
+            mcgout = 32768u * 640u * (((MCG->C4 & MCG_C4_DRST_DRS_MASK) >> 5)
+                    + 1);
+        else
+            mcgout = 8000000u / (32u << ((MCG->C1 >> 3) & 0x7u)) * 640u
+                * (((MCG->C4 & MCG_C4_DRST_DRS_MASK) >> 5) + 1);
+        break;
+    case 1:
+        mcgout = (MCG->C2 & MCG_C2_IRCS_MASK)
+            ? 4000000u >> ((MCG->SC & MCG_SC_FCRDIV_MASK) >> 1) : 32768u;
+        break;
+    case 2:
+        mcgout = 8000000u;
+        break;
+    default:
+        return;
+    }
+
+    SystemCoreClock = mcgout / (((SIM->CLKDIV1 & SIM_CLKDIV1_OUTDIV1_MASK)
+            >> SIM_CLKDIV1_OUTDIV1_SHIFT) + 1);
+}
@@ -0,0 +1,324 @@
+/* -------------------------------------
+ * Replay of a record mode trace on the simulator.
+ *
+ * A trace recorded with TRACE_INPUTS, on the board or with pelican_sim -t,
+ * holds every input the firmware read: the ADC conversions, the presses and
+ * the SysTick count of each frame. This tool runs the firmware again on the
+ * simulator, with each conversion returning the recorded result and each
+ * press delivered at its recorded time, and compares the trace of the
+ * replay with the recorded one, record by record. It stops at the first
+ * record that differs, and prints the frame and the records before it.
+ *
+ * The same build replays a trace exactly. A build with a change, such as a
+ * fix or another SAMPLER_FILTER, shows the first frame at which the change
+ * alters the behaviour on the recorded inputs. Virtual time is not tied to
+ * the wall clock: a day of operation replays in seconds.
+ *
+ * Build and run from this directory:
+ *
+ *   gcc -O2 -Dmain=firmware_main -DTRACE_INPUTS=1 -I. -I../include \
+ *       -o replay replay.c trace_read.c sim.c registers.c ../src/main.c \
+ *       ../src/pelican.c ../src/stm.c ../src/sched.c ../src/trace.c \
+ *       ../src/calib.c
+ *   ./replay [-n records] [-f flash] trace
+ *
+ * -n sets the records printed before a divergence (default 10). The trace
+ * must start at reset. A trace of a warm boot, from the calibration cache,
+ * replays with -f and the flash image the board or pelican_sim -f started
+ * from; the image is not written.
+ * -------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "MKL25Z4.H"
+#include "pelican.h"
+#include "stm.h"
+#include "trace.h"
+#include "sim.h"
+#include "trace_read.h"
+
+// The firmware is built with -Dmain=firmware_main; this file keeps main().
+#undef main
+
+#if !TRACE_INPUTS
+#error "build with -DTRACE_INPUTS=1, so that the replay is traced as recorded"
+#endif
+
+#define LINE_MAX (96)
+#define RUN_OVER (10000) // Time run past the end of the trace, in ms.
+
+extern int firmware_main(void);
+
+// A stream of records from the trace file.
+struct Log {
+    FILE *f;
+    struct TraceReader reader;
+};
+
+// The trace read for the conversions, and for the records to compare.
+static struct Log adcLog, checkLog;
+
+// Presses, as recorded SysTickTicks, in order.
+static uint64_t *presses;
+static unsigned pressCount = 0, nextPress = 0;
+
+// SysTickTicks of the first frame, recorded and replayed. Reset takes
+// longer on the board than in the simulator, so the presses are placed
+// from the first frame.
+static uint32_t firstFrame = 0, replayFirst = 0;
+
+static int context = 10; // -n.
+
+// The last 'context' recorded lines.
+static char (*history)[LINE_MAX];
+static unsigned historyCount = 0;
+
+// Progress of the comparison.
+static unsigned long frames = 0, records = 0;
+static int framesSeen = 0;
+static int finished = 0, diverged = 0;
+
+static struct TraceReader replayReader;
+
+static int logOpen(struct Log *log, const char *name) {
+    if ((log->f = fopen(name, "rb")) == NULL)
+        return 0;
+
+    TraceReaderInit(&log->reader);
+    return 1;
+}
+
+// Next record of a stream.
+//   Return: 1 if read, 0 at the end of the trace
+static int logNext(struct Log *log, struct TraceEntry *e) {
+    int c;
+
+    while ((c = getc(log->f)) != EOF)
+        if (TraceReaderPut(&log->reader, (uint8_t) c, e))
+            return 1;
+
+    return 0;
+}
+
+// Read the presses, as the tick at which to deliver each, and the frames. A
+// press is recorded in the frame in which the firmware first saw it, with
+// the time since its edge: it is delivered that long before the frame, and
+// no later than the tick of the frame, so that the firmware sees it at the
+// same point. The simulator stamps a press delivered at tick t with t ms.
+//   Return: ticks from the first frame to the last, 0 if there are none
+static uint64_t scan(struct Log *log) {
+    struct TraceEntry e;
+    uint64_t frame = 0, tick;
+    unsigned size = 0;
+
+    while (logNext(log, &e)) {
+        if (e.type == TRACE_FRAME) {
+            if (frames++ == 0)
+                firstFrame = e.value;
+            frame += e.value;
+        }
+
+        if (e.type != TRACE_PRESS)
+            continue;
+
+        tick = (frame > e.value / 1000) ? frame - e.value / 1000 : 0;
+
+        if (pressCount == size) {
+            size = (size) ? 2 * size : 64;
+            presses = realloc(presses, size * sizeof *presses);
+            if (presses == NULL) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        presses[pressCount++] = tick;
+    }
+
+    return (frames) ? frame - firstFrame : 0;
+}
+
+// Keep a recorded line for the report of a divergence.
+static void remember(const struct TraceEntry *e) {
+    unsigned i;
+
+    if (context <= 0)
+        return;
+    if (historyCount == (unsigned) context) {
+        for (i = 1; i < historyCount; i++)
+            memcpy(history[i - 1], history[i], LINE_MAX);
+        historyCount--;
+    }
+    TraceFormat(history[historyCount++], LINE_MAX, e);
+}
+
+static void report(const struct TraceEntry *recorded,
+        const struct TraceEntry *replayed) {
+    char line[LINE_MAX];
+    unsigned i;
+
+    printf("diverged in frame %lu, after %lu records:\n\n", frames, records);
+    for (i = 0; i < historyCount; i++)
+        printf("          %s", history[i]);
+
+    TraceFormat(line, sizeof line, recorded);
+    printf("recorded  %s", line);
+    TraceFormat(line, sizeof line, replayed);
+    printf("replayed  %s\n", line);
+}
+
+// Deliver the presses due at this tick, once the first frame is known, and
+// end the run once the trace is compared.
+static void tick(void) {
+    if (finished || diverged)
+        longjmp(SimExit, 1);
+
+    while (framesSeen && nextPress < pressCount
+            && presses[nextPress] + replayFirst <= SimTime + firstFrame) {
+        SimButton(0);
+        nextPress++;
+    }
+}
+
+// Each conversion returns the next recorded one.
+static unsigned adc(void) {
+    struct TraceEntry e;
+
+    while (logNext(&adcLog, &e))
+        if (e.type == TRACE_ADC)
+            return e.value;
+
+    return 0;
+}
+
+// The values of two records agree. The first frame is counted from reset,
+// which takes longer on the board. Times measured with StampNow() agree to
+// the 1 ms resolution of the simulated TPM0.
+static int same(const struct TraceEntry *recorded,
+        const struct TraceEntry *replayed) {
+    uint32_t a = recorded->value, b = replayed->value;
+
+    switch (recorded->type) {
+        case TRACE_FRAME:
+            return a == b || !framesSeen;
+        case TRACE_BUTTON:
+        case TRACE_PRESS:
+            return ((a > b) ? a - b : b - a) < 1000;
+        default:
+            return a == b;
+    }
+}
+
+// A byte of the replay trace: compare each record with the recorded one.
+static void uart(uint8_t byte) {
+    struct TraceEntry replayed, recorded;
+
+    if (finished || diverged
+            || !TraceReaderPut(&replayReader, byte, &replayed))
+        return;
+
+    if (!logNext(&checkLog, &recorded)) {
+        finished = 1;
+        return;
+    }
+
+    if (recorded.type == TRACE_FRAME)
+        frames++;
+
+    if (recorded.type != replayed.type
+            || recorded.crossing != replayed.crossing
+            || recorded.state != replayed.state
+            || !same(&recorded, &replayed)) {
+        diverged = 1;
+        report(&recorded, &replayed);
+        return;
+    }
+
+    if (recorded.type == TRACE_FRAME && !framesSeen) {
+        replayFirst = replayed.value;
+        framesSeen = 1;
+    }
+
+    records++;
+    remember(&recorded);
+}
+
+int main(int argc, char *argv[]) {
+    struct Log scanLog;
+    struct timespec start, end;
+    const char *flashName = 0;
+    uint64_t length;
+    double seconds;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:f:")) != -1) {
+        switch (opt) {
+            case 'n': context = atoi(optarg); break;
+            case 'f': flashName = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-n records] [-f flash] trace\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "usage: %s [-n records] [-f flash] trace\n",
+                argv[0]);
+        return 1;
+    }
+
+    if (!logOpen(&scanLog, argv[optind]) || !logOpen(&adcLog, argv[optind])
+            || !logOpen(&checkLog, argv[optind])) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    if (context > 0)
+        history = malloc((size_t) context * LINE_MAX);
+    if (context > 0 && history == NULL) {
+        perror("malloc");
+        return 1;
+    }
+
+    length = scan(&scanLog);
+    fclose(scanLog.f);
+    if (frames == 0) {
+        fprintf(stderr, "%s: no frame records; record with TRACE_INPUTS\n",
+                argv[optind]);
+        return 1;
+    }
+    frames = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    TraceReaderInit(&replayReader);
+    SimReset(1);
+    if (flashName && SimFlashLoad(flashName) <= 0) {
+        fprintf(stderr, "%s: no flash image\n", flashName);
+        return 1;
+    }
+
+    SimTickHook = tick;
+    SimADCHook = adc;
+    SimUARTHook = uart;
+    SimRun(firmware_main, length + RUN_OVER);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    if (!diverged)
+        printf("%s: %lu frames, %lu records\n", (finished) ? "identical"
+                : "replay ended before the trace", frames, records);
+    printf("replayed %.3f s in %.3f s\n", SimTime / 1000.0, seconds);
+
+    fclose(adcLog.f);
+    fclose(checkLog.f);
+    free(presses);
+    free(history);
+
+    return (diverged || !finished) ? 2 : 0;
+}
@@ -0,0 +1,455 @@
+#include <string.h>
+#include <stdio.h>
+#include "MKL25Z4.H"
+#include "pelican.h"
+#include "stm.h"
+#include "sim.h"
+
+// -----------------------------------
+// Peripheral simulator: virtual clock, GPIO, button, ADC and UART models.
+// -----------------------------------
+
+uint64_t SimTime = 0;
+void (*SimTickHook)(void) = 0;
+jmp_buf SimExit;
+
+unsigned SimLampCounts[6] = {400, 380, 420, 300, 310, 250};
+unsigned SimNoise = 0;
+
+// End of the current run, in ms.
+uint64_t SimEnd = 0;
+
+// Fault of each lamp of each crossing.
+enum SimFault SimFaults[CROSSINGS][6];
+
+// Crossings with a button press waiting for the next tick, one bit each.
+unsigned SimButtonPending = 0;
+
+// State of the noise generator.
+uint32_t SimSeed = 1;
+
+FILE *SimUARTOut = 0;
+void (*SimUARTHook)(uint8_t byte) = 0;
+uint64_t SimUARTBytes = 0;
+unsigned (*SimADCHook)(void) = 0;
+
+// Bit times of UART0 not yet used, in tenths of a byte.
+double SimUARTCredit = 0;
+
+uint32_t SimFlash[SIM_FLASH_SIZE / 4];
+uint32_t SimUID[3] = {0x00000018u, 0x4e453154u, 0x2005002eu};
+
+// Error flags of the last flash command, for the next test of CCIF.
+uint8_t SimFlashErrors = 0;
+
+// Register file and NVIC state, in registers.c.
+extern uint32_t NVIC_Enabled;
+extern uint32_t NVIC_Pending;
+
+// Firmware interrupt handlers. The ADC handler only exists in some sampling
+// modes.
+extern void SysTick_Handler(void);
+extern void PORTD_IRQHandler(void);
+extern void ADC0_IRQHandler(void) __attribute__((weak));
+extern void TPM0_IRQHandler(void) __attribute__((weak));
+extern void DMA1_IRQHandler(void) __attribute__((weak));
+
+// Trace ring sent by DMA channel 1, if the firmware is built with TRACE.
+extern volatile uint8_t TraceRing[] __attribute__((weak));
+
+const char *const SimStateNames[NUMSTATES] = {
+    "REDINIT", "AMBERINIT", "AMBERFAILUREINIT", "GREENINIT", "DONTWALKINIT",
+    "WALKINIT", "WAITINIT", "REDANDDONTWALK", "WAITFLASHINGON",
+    "WAITFLASHINGOFF", "GREENON", "WAITON", "AMBERON", "AMBERFAILURE",
+    "REDON", "WALKON", "DONTWALKON", "AMBERANDREDON", "AMBERFAILUREANDREDON"
+};
+
+const char *const SimSignalNames[6] = {
+    "red", "amber", "green", "dontwalk", "walk", "wait"
+};
+
+const char *const SimFaultNames[3] = {"ok", "open", "short"};
+
+const char *const SimClockNames[CLOCK_PROFILES] = {
+    "CLOCK_RUN", "CLOCK_FEI", "CLOCK_BLPE", "CLOCK_VLPR"
+};
+
+// Clear the registers, the virtual clock and the faults.
+void SimReset(uint32_t seed) {
+    memset(&SIM_Host, 0, sizeof SIM_Host);
+    memset(&SysTick_Host, 0, sizeof SysTick_Host);
+    memset(&PORTB_Host, 0, sizeof PORTB_Host);
+    memset(&PORTD_Host, 0, sizeof PORTD_Host);
+    memset(&PORTE_Host, 0, sizeof PORTE_Host);
+    memset(&PTB_Host, 0, sizeof PTB_Host);
+    memset(&PTD_Host, 0, sizeof PTD_Host);
+    *(uint32_t *) &PTD->PDIR = 0xffffffffu; // Buttons released, pulled up.
+    memset(&PTE_Host, 0, sizeof PTE_Host);
+    memset(&ADC0_Host, 0, sizeof ADC0_Host);
+    memset(&TPM0_Host, 0, sizeof TPM0_Host);
+    memset(&PORTA_Host, 0, sizeof PORTA_Host);
+    memset(&UART0_Host, 0, sizeof UART0_Host);
+    memset(&DMAMUX0_Host, 0, sizeof DMAMUX0_Host);
+    memset(&DMA0_Host, 0, sizeof DMA0_Host);
+    NVIC_Enabled = 0;
+
+    // A new chip: flash erased, no command running.
+    memset(&FTFA_Host, 0, sizeof FTFA_Host);
+    FTFA->FSTAT = 0x80u; // CCIF.
+    memset(SimFlash, 0xff, sizeof SimFlash);
+    SimFlashErrors = 0;
+    *(uint32_t *) &SIM->UIDMH = SimUID[0];
+    *(uint32_t *) &SIM->UIDML = SimUID[1];
+    *(uint32_t *) &SIM->UIDL = SimUID[2];
+
+    // Clocks as left by SystemInit() with CLOCK_SETUP 1: PEE, core 48 MHz,
+    // bus 24 MHz.
+    memset(&MCG_Host, 0, sizeof MCG_Host);
+    memset(&SMC_Host, 0, sizeof SMC_Host);
+    SIM->CLKDIV1 = SIM_CLKDIV1_OUTDIV1(1) | SIM_CLKDIV1_OUTDIV4(1);
+    OSC0->CR = OSC_CR_ERCLKEN_MASK | OSC_CR_SC2P_MASK | OSC_CR_SC16P_MASK;
+    MCG->C1 = MCG_C1_CLKS(0) | MCG_C1_FRDIV(3) | MCG_C1_IRCLKEN_MASK;
+    MCG->C2 = MCG_C2_RANGE0(2) | MCG_C2_EREFS0_MASK;
+    MCG->C5 = MCG_C5_PRDIV0(1);
+    MCG->C6 = MCG_C6_PLLS_MASK;
+    SimMCGStatus();
+    SystemCoreClockUpdate();
+    NVIC_Pending = 0;
+
+    memset(SimFaults, 0, sizeof SimFaults);
+    SimTime = 0;
+    SimButtonPending = 0;
+    SimSeed = (seed) ? seed : 1;
+    SimUARTBytes = 0;
+    SimUARTCredit = 0;
+}
+
+// Run the firmware until the virtual clock reaches 'end'.
+void SimRun(int (*firmware)(void), uint64_t end) {
+    SimEnd = end;
+
+    if (setjmp(SimExit) == 0)
+        firmware();
+}
+
+void SimButton(int n) {
+    SimButtonPending |= 1U << n;
+}
+
+void SimButtonHold(int n, int held) {
+    uint32_t pin = MASK(CrossingPins[n].button);
+
+    if (held)
+        *(uint32_t *) &PTD->PDIR &= ~pin;
+    else
+        *(uint32_t *) &PTD->PDIR |= pin;
+}
+
+void SimSetFault(int n, int ps, enum SimFault fault) {
+    SimFaults[n][ps] = fault;
+}
+
+// -----------------------------------
+// GPIO
+// -----------------------------------
+
+// Apply the set and clear registers to the data output registers. A bit
+// both set and cleared since the last update ends cleared: the signals are
+// written whole to PDOR once a frame, and only cleared through PCOR for the
+// safe state, which always has the last word.
+void SimGPIOUpdate(volatile GPIO_Type *gpio) {
+    uint32_t set = gpio->PSOR;
+    uint32_t clear = gpio->PCOR;
+    uint32_t toggle = gpio->PTOR;
+
+    gpio->PDOR = ((gpio->PDOR | set) ^ toggle) & ~clear;
+    gpio->PSOR = 0;
+    gpio->PCOR = 0;
+    gpio->PTOR = 0;
+}
+
+unsigned SimOutputs(int n) {
+    unsigned outputs = 0;
+    int ps;
+
+    SimGPIOUpdate(PTE);
+
+    for (ps = 0; ps < 6; ps++)
+        if (PTE->PDOR & PTE->PDDR & MASK(CrossingPins[n].signal[ps]))
+            outputs |= 1U << ps;
+
+    return outputs;
+}
+
+// -----------------------------------
+// ADC
+// -----------------------------------
+
+unsigned SimProbe(int n) {
+    unsigned outputs = SimOutputs(n);
+    unsigned sum = 0;
+    int ps;
+
+    for (ps = 0; ps < 6; ps++) {
+        if (!(outputs & (1U << ps)) || SimFaults[n][ps] == SIM_OPEN)
+            continue;
+
+        // A shorted lamp draws twice its current.
+        sum += (SimFaults[n][ps] == SIM_SHORT)
+            ? 2 * SimLampCounts[ps] : SimLampCounts[ps];
+    }
+
+    return sum;
+}
+
+// One conversion of a channel, with noise, limited to 12 bits. A channel
+// that is not the probe of a crossing reads 0 and the noise.
+unsigned SimSample(unsigned channel) {
+    int value = 0;
+    int n;
+
+    for (n = 0; n < CROSSINGS; n++)
+        if (CrossingPins[n].probe == channel)
+            value = SimProbe(n);
+
+    if (SimNoise) {
+        SimSeed = SimSeed * 1103515245u + 12345u;
+        value += (int) ((SimSeed >> 16) % (2 * SimNoise + 1)) - (int) SimNoise;
+    }
+
+    if (value < 0)
+        value = 0;
+    if (value > ADCRANGE)
+        value = ADCRANGE;
+
+    return value;
+}
+
+// A conversion was started by writing SC1[0]: complete it at once.
+void SimADCConvert(void) {
+    if ((ADC0->SC1[0] & ADC_SC1_ADCH_MASK) == ADC_SC1_ADCH_MASK)
+        return; // ADC disabled.
+
+    *(uint32_t *) &ADC0->R[0] = (SimADCHook) ? SimADCHook()
+        : SimSample(ADC0->SC1[0] & ADC_SC1_ADCH_MASK);
+    ADC0->SC1[0] |= 0x80u; // COCO.
+}
+
+// The firmware launches a flash command by writing CCIF, and then tests
+// CCIF until the command completes. The command in FCCOB runs at once, at
+// the launch, and FCCOB0 is cleared. The launch write then sets FSTAT, so
+// the error flags are added at the next test.
+void SimFlashCommand(void) {
+    uint32_t addr, data;
+    uint8_t errors = 0;
+
+    if (FTFA->FCCOB0 == 0) {
+        FTFA->FSTAT |= SimFlashErrors;
+        SimFlashErrors = 0;
+        return;
+    }
+
+    addr = ((uint32_t) FTFA->FCCOB1 << 16) | ((uint32_t) FTFA->FCCOB2 << 8)
+        | FTFA->FCCOB3;
+    data = ((uint32_t) FTFA->FCCOB4 << 24) | ((uint32_t) FTFA->FCCOB5 << 16)
+        | ((uint32_t) FTFA->FCCOB6 << 8) | FTFA->FCCOB7;
+
+    switch (FTFA->FCCOB0) {
+        case 0x09: // Erase flash sector.
+            if (addr % SIM_FLASH_SECTOR || addr >= SIM_FLASH_SIZE)
+                errors = FTFA_FSTAT_ACCERR_MASK;
+            else
+                memset(&SimFlash[addr / 4], 0xff, SIM_FLASH_SECTOR);
+            break;
+        case 0x06: // Program longword: bits can only be cleared.
+            if (addr % 4 || addr >= SIM_FLASH_SIZE) {
+                errors = FTFA_FSTAT_ACCERR_MASK;
+            } else {
+                SimFlash[addr / 4] &= data;
+                if (SimFlash[addr / 4] != data)
+                    errors = FTFA_FSTAT_MGSTAT0_MASK;
+            }
+            break;
+        default:
+            errors = FTFA_FSTAT_ACCERR_MASK;
+    }
+
+    FTFA->FCCOB0 = 0;
+    SimFlashErrors = errors;
+}
+
+// The launch and wait of FlashRunCode (calib.c), in C.
+void SimFlashRun(volatile uint8_t *fstat) {
+    *fstat = FTFA_FSTAT_CCIF_MASK;
+    while (!(*fstat & FTFA_FSTAT_CCIF_MASK))
+        ;
+}
+
+int SimFlashLoad(const char *name) {
+    FILE *f = fopen(name, "rb");
+    size_t n;
+
+    if (f == 0)
+        return 0; // A new board.
+
+    n = fread(SimFlash, 1, sizeof SimFlash, f);
+    fclose(f);
+    return (n == sizeof SimFlash) ? 1 : -1;
+}
+
+int SimFlashSave(const char *name) {
+    FILE *f = fopen(name, "wb");
+    size_t n;
+
+    if (f == 0)
+        return -1;
+
+    n = fwrite(SimFlash, 1, sizeof SimFlash, f);
+    return (fclose(f) == 0 && n == sizeof SimFlash) ? 0 : -1;
+}
+
+// The calibration completes at once, without failure; the CLPx and CLMx
+// results are left at 0.
+void SimADCCalibrate(void) {
+    ADC0->SC3 &= ~0xC0u; // CAL and CALF.
+}
+
+// Continuous conversions against the compare window: one per tick. Only a
+// result outside [CV1, CV2] completes and interrupts.
+void SimADCWindow(void) {
+    unsigned sample;
+
+    if (!(ADC0->SC3 & ADC_SC3_ADCO_MASK) || !(ADC0->SC2 & ADC_SC2_ACFE_MASK)
+            || !(ADC0->SC1[0] & ADC_SC1_AIEN_MASK) || ADC0_IRQHandler == 0)
+        return;
+
+    sample = SimSample(ADC0->SC1[0] & ADC_SC1_ADCH_MASK);
+    if (sample >= ADC0->CV1 && sample <= ADC0->CV2)
+        return;
+
+    *(uint32_t *) &ADC0->R[0] = sample;
+    ADC0->SC1[0] |= 0x80u; // COCO.
+
+    if (NVIC_Enabled & (1UL << ADC0_IRQn))
+        ADC0_IRQHandler();
+}
+
+// TPM0 running from the 8 MHz OSCERCLK: advance its counter by one tick and
+// interrupt on an overflow.
+void SimTPM(void) {
+    uint32_t count;
+
+    if (!(TPM0->SC & TPM_SC_CMOD_MASK))
+        return;
+
+    count = TPM0->CNT + (8000u >> (TPM0->SC & 0x7u));
+    if (count > TPM0->MOD) {
+        count -= TPM0->MOD + 1;
+        TPM0->SC |= TPM_SC_TOF_MASK;
+    }
+    TPM0->CNT = count;
+
+    if ((TPM0->SC & TPM_SC_TOF_MASK) && (TPM0->SC & TPM_SC_TOIE_MASK)
+            && (NVIC_Enabled & (1UL << TPM0_IRQn)) && TPM0_IRQHandler) {
+        TPM0_IRQHandler();
+        TPM0->SC &= ~TPM_SC_TOF_MASK; // The handler writes 1 to clear.
+    }
+}
+
+// -----------------------------------
+// UART0
+// -----------------------------------
+
+// UART0 transmitting from DMA channel 1 at the rate set by its registers,
+// from the 8 MHz OSCERCLK: send the bytes of one tick to SimUARTOut. The
+// DMA addresses are 32 bits, which cannot hold a host pointer, so the source
+// address is taken as an offset in TraceRing.
+void SimUART(void) {
+    uint32_t sbr = ((UART0->BDH & 0x1Fu) << 8) | UART0->BDL;
+    uint32_t ratio = (UART0->C4 & UART0_C4_OSR_MASK) + 1;
+    uint32_t smod = (DMA0->DMA[1].DCR >> 12) & 0xFu;
+    uint32_t size = (smod) ? 16u << (smod - 1) : 0;
+    uint32_t bcr, offset;
+
+    if (!(UART0->C2 & UART0_C2_TE_MASK) || !(UART0->C2 & UART0_C2_TIE_MASK)
+            || !(UART0->C5 & UART0_C5_TDMAE_MASK) || sbr == 0
+            || !(DMAMUX0->CHCFG[1] & DMAMUX_CHCFG_ENBL_MASK)
+            || !(DMA0->DMA[1].DCR & DMA_DCR_ERQ_MASK) || size == 0
+            || TraceRing == 0) {
+        SimUARTCredit = 0; // The transmitter is idle.
+        return;
+    }
+
+    SimUARTCredit += 8000000.0 / (ratio * sbr) / 1000.0;
+
+    while (SimUARTCredit >= 10 && (DMA0->DMA[1].DCR & DMA_DCR_ERQ_MASK)
+            && (bcr = DMA0->DMA[1].DSR_BCR & DMA_DSR_BCR_BCR_MASK) != 0) {
+        offset = DMA0->DMA[1].SAR - (uint32_t) (uintptr_t) TraceRing;
+        if (SimUARTOut)
+            fputc(TraceRing[offset & (size - 1)], SimUARTOut);
+        if (SimUARTHook)
+            SimUARTHook(TraceRing[offset & (size - 1)]);
+        SimUARTBytes++;
+        SimUARTCredit -= 10; // Start, 8 data bits and stop.
+
+        // The source wraps on the modulo, the count runs down.
+        DMA0->DMA[1].SAR = (DMA0->DMA[1].SAR & ~(size - 1))
+            | ((DMA0->DMA[1].SAR + 1) & (size - 1));
+        DMA0->DMA[1].DSR_BCR = bcr - 1;
+        if (bcr > 1)
+            continue;
+
+        DMA0->DMA[1].DSR_BCR = DMA_DSR_BCR_DONE_MASK;
+        if (DMA0->DMA[1].DCR & DMA_DCR_D_REQ_MASK)
+            DMA0->DMA[1].DCR &= ~DMA_DCR_ERQ_MASK;
+
+        if ((DMA0->DMA[1].DCR & DMA_DCR_EINT_MASK)
+                && (NVIC_Enabled & (1UL << DMA1_IRQn)) && DMA1_IRQHandler) {
+            DMA1_IRQHandler();
+            // The handler writes 1 to clear DONE, or starts a new count.
+            DMA0->DMA[1].DSR_BCR &= ~DMA_DSR_BCR_DONE_MASK;
+        }
+    }
+}
+
+// -----------------------------------
+// Virtual clock
+// -----------------------------------
+
+// The core sleeps until the next interrupt, which is at most one tick away:
+// advance one tick and deliver the interrupts of that tick.
+void SimWFI(void) {
+    SimGPIOUpdate(PTB);
+    SimGPIOUpdate(PTE);
+
+    if (SimTime >= SimEnd)
+        longjmp(SimExit, 1);
+
+    SimTime++;
+
+    if (SimTickHook)
+        SimTickHook();
+
+    SimTPM();
+    SimUART();
+
+    if (SimButtonPending && (NVIC_Enabled & (1UL << PORTD_IRQn))) {
+        int n;
+
+        PORTD->ISFR = 0;
+        for (n = 0; n < CROSSINGS; n++)
+            if (SimButtonPending & (1U << n))
+                PORTD->ISFR |= MASK(CrossingPins[n].button);
+
+        SimButtonPending = 0;
+        PORTD_IRQHandler();
+        PORTD->ISFR = 0; // The handler writes 1s to clear.
+    }
+
+    SimADCWindow();
+
+    if (SysTick->CTRL & SysTick_CTRL_TICKINT_Msk) {
+        SysTick->VAL = SysTick->LOAD;
+        SysTick_Handler();
+    }
+}
@@ -0,0 +1,125 @@
+#ifndef __SIM_H
+#define __SIM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <setjmp.h>
+
+// -----------------------------------
+// Peripheral simulator
+//
+// Runs the firmware on a PC in virtual time. Every WFI of the firmware
+// advances the virtual clock by one SysTick (1 ms) and delivers the
+// interrupts that are due: a scripted button press to PORTD_IRQHandler, then
+// SysTick_Handler. The GPIO writes since the last WFI are applied to the
+// outputs first, and each ADC conversion returns the sum of the currents of
+// the lamps that are on, for the crossing whose probe channel it converts.
+//
+// The firmware must be built with IDLE_WFI (the default) and
+// ADC_SAMPLING_SOFTWARE or ADC_SAMPLING_WINDOW (the window is checked once
+// per tick); the PIT, and the DMA of the ADC, are not simulated. UART0 sends
+// the trace ring by DMA channel 1, at its baud rate. For a replay, the
+// conversions and the bytes sent can be taken over by hooks.
+// -----------------------------------
+
+// Lamp faults, as set with the DIP switches on the signal board.
+enum SimFault {SIM_OK, SIM_OPEN, SIM_SHORT};
+
+// Virtual time in ms (SysTicks) since SimReset().
+extern uint64_t SimTime;
+
+// Called at every tick, before the interrupts of that tick are delivered.
+extern void (*SimTickHook)(void);
+
+// Return point of SimRun(), taken when the run ends.
+extern jmp_buf SimExit;
+
+// ADC counts drawn by each working lamp, indexed by PelicanSignal.
+extern unsigned SimLampCounts[6];
+
+// Peak of the uniform noise added to each conversion, in counts.
+extern unsigned SimNoise;
+
+// Bytes sent by UART0 (the trace, see trace.h) are written here, if set.
+extern FILE *SimUARTOut;
+
+// Called with each byte sent by UART0, if set.
+extern void (*SimUARTHook)(uint8_t byte);
+
+// Bytes sent by UART0 since SimReset().
+extern uint64_t SimUARTBytes;
+
+// If set, gives the result of each single conversion instead of the lamps.
+extern unsigned (*SimADCHook)(void);
+
+// Names for reports: states (NUMSTATES), signals (as in the scripts),
+// faults and clock profiles.
+extern const char *const SimStateNames[];
+extern const char *const SimSignalNames[6];
+extern const char *const SimFaultNames[3];
+extern const char *const SimClockNames[CLOCK_PROFILES];
+
+// Clear the registers, the virtual clock and the faults.
+//   Param: seed of the noise
+extern void SimReset(uint32_t seed);
+
+// Run the firmware until the virtual clock reaches 'end' ms, then return.
+//   Param: entry point of the firmware (main, renamed), end time in ms
+extern void SimRun(int (*firmware)(void), uint64_t end);
+
+// The functions below take the index of a crossing, as in CrossingPins. Its
+// outputs, button and probe are those of its pin map.
+
+// Press the CROSSING button; the interrupt is delivered at the next tick.
+//   Param: crossing
+extern void SimButton(int n);
+
+// Hold the CROSSING button down, low on its pin, or release it. The level
+// only: a press to be taken by the firmware is SimButton().
+//   Param: crossing, 1 to hold, 0 to release
+extern void SimButtonHold(int n, int held);
+
+// Set the fault of a lamp.
+//   Param: crossing, PelicanSignal, fault
+extern void SimSetFault(int n, int ps, enum SimFault fault);
+
+// Signals that are on, one bit per PelicanSignal.
+//   Param: crossing
+extern unsigned SimOutputs(int n);
+
+// Probe point value of the current outputs, in ADC counts, without noise.
+//   Param: crossing
+extern unsigned SimProbe(int n);
+
+// -----------------------------------
+// Flash
+//
+// The program flash is SimFlash (MKL25Z4.H), erased by SimReset(). FTFA
+// commands run at once, so a flash write takes no virtual time. An image of
+// the flash carries the calibration cache (calib.h) from one run to the next.
+// -----------------------------------
+
+#define SIM_FLASH_SECTOR (1024) // Bytes erased by one command.
+
+// Unique ID of the chip (SIM UIDMH, UIDML, UIDL), set by SimReset().
+extern uint32_t SimUID[3];
+
+// Load the flash from an image written by SimFlashSave(), after SimReset().
+//   Param: file name
+//   Return: 1 if loaded, 0 if the file does not exist (the flash is left
+//     erased), -1 if it is not an image
+extern int SimFlashLoad(const char *name);
+
+// Write the flash to an image.
+//   Param: file name
+//   Return: 0, or -1 on error
+extern int SimFlashSave(const char *name);
+
+// Hooks called by the replacement MKL25Z4.H.
+extern void SimWFI(void);
+extern void SimADCConvert(void);
+extern void SimADCCalibrate(void);
+extern void SimFlashCommand(void);
+extern void SimFlashRun(volatile uint8_t *fstat);
+
+#endif
@@ -0,0 +1,652 @@
+/* -------------------------------------
+ * Monte Carlo sweep of the timings T1 to T7 against pedestrian demand.
+ *
+ * The timings of stm.h are fixed guesses; this tool measures what they cost
+ * the pedestrians and the traffic. It runs the STM of stm.c, with the
+ * signal, button and ADC functions of pelican.c replaced by models as in
+ * bench_stm.c, for CROSSINGS crossings side by side through executeFrame().
+ * Pedestrians arrive at each crossing at random, as a Poisson process of
+ * 'rate' an hour. One who finds WALK lit crosses at once. The others wait,
+ * and press the button whenever WAIT is off, as a pedestrian who sees no
+ * request would; all of them cross when WALK goes on.
+ *
+ * Each configuration of the sweep, a value of every timing and a rate, runs
+ * for 'hours' crossing-hours of normal operation, split into tasks of
+ * CROSSINGS crossings for TASK_HOURS hours. Each task is a child process,
+ * with its own copy of StmTable and its own random streams, seeded from the
+ * configuration, the task and the crossing only. The tasks share nothing, so
+ * up to -j of them run at once, one per core, and the results do not depend
+ * on -j. A child leaves its result in a slot of shared memory, which the
+ * parent adds to the totals of the configuration when the child ends.
+ *
+ * For each configuration the report gives:
+ *   - walks/h, the WALK phases an hour, and crossed/h, the pedestrians who
+ *     crossed an hour;
+ *   - the wait from arrival to WALK: mean, 50th, 90th and 99th percentile
+ *     and max, in s;
+ *   - green, the share of the time that the traffic has GREEN, and cycle,
+ *     the share of the time out of GREENON, in the crossing cycle.
+ *
+ * Build and run from this directory (without the frame statistics, and with
+ * the transition table in RAM, so that its timings can be set; the pin map
+ * of pelican.c is not linked):
+ *
+ *   gcc -O2 -DSTM_STATS=0 -DCROSSINGS=16 -DSTM_TABLE_CONST= -I. \
+ *       -I../include -o timing_sweep timing_sweep.c registers.c \
+ *       ../src/stm.c -lm
+ *   ./timing_sweep [-j jobs] [-h hours] [-r rates] [-T n=values]...
+ *       [-s seed] [-o csv]
+ *
+ *   -j  tasks run in parallel (default: number of cores)
+ *   -h  crossing-hours per configuration (default 4096)
+ *   -r  pedestrians an hour at each crossing (default 60)
+ *   -T  values of the timing Tn, in s (default: that of stm.h)
+ *   -s  seed of the random streams (default 1)
+ *   -o  write every configuration to a CSV file
+ *
+ * Values are a list of numbers and ranges: 30, 20,30, 20:40 (step 1) or
+ * 10,20:40:5. The sweep runs every combination of the values given. T7 only
+ * times the WAIT flashing after a failure, which the model never has.
+ * -------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <MKL25Z4.H>
+#include "pelican.h"
+#include "stm.h"
+#include "calib.h"
+
+#define TIMINGS (7)        // T1 to T7.
+#define DIMS (TIMINGS + 1) // The timings and the rate.
+#define MAX_VALUES (64)    // Values of one dimension of the sweep.
+#define TASK_HOURS (16)    // Hours run by each crossing of a task.
+#define WARMUP_FRAMES (CYCLESPERSEC * 600) // Longest initiation, in frames.
+#define FRAMES_PER_HOUR (CYCLESPERSEC * 3600)
+#define PED_QUEUE (8192)   // Pedestrians waiting at a crossing; a power of 2.
+#define WAIT_BIN (2)       // Width of a wait histogram bin, in frames.
+#define WAIT_BINS (2048)   // Bins; the last also counts longer waits.
+
+// Rows timed by each of T1 to T7, -1 for none.
+static const int TimingRows[TIMINGS][2] = {
+    {AMBERON, AMBERFAILURE},               // T1
+    {REDON, -1},                           // T2
+    {WALKON, -1},                          // T3
+    {REDANDDONTWALK, DONTWALKON},          // T4
+    {AMBERANDREDON, AMBERFAILUREANDREDON}, // T5
+    {WAITON, -1},                          // T6
+    {WAITFLASHINGON, WAITFLASHINGOFF},     // T7
+};
+
+// Values of the timings, in stm.h, and of the rate if no -r is given.
+static const int Defaults[DIMS] = {T1, T2, T3, T4, T5, T6, T7, 60};
+
+static const char *const DimNames[DIMS] = {
+    "T1", "T2", "T3", "T4", "T5", "T6", "T7", "rate"
+};
+
+// Result of a task, or the totals of a configuration.
+struct Result {
+    uint64_t frames;    // Frames of normal operation, of all crossings.
+    uint64_t green;     // Frames with GREEN on.
+    uint64_t cycle;     // Frames out of GREENON.
+    uint64_t walks;     // WALK phases.
+    uint64_t arrivals;  // Pedestrians who arrived.
+    uint64_t crossed;   // Pedestrians who crossed.
+    uint64_t presses;   // Button presses.
+    uint64_t overflows; // Pedestrians not kept, as the queue was full.
+    uint64_t waitSum;   // Sum of the waits of those who crossed, in frames.
+    uint32_t waitMax;   // Longest wait, in frames.
+    uint32_t hist[WAIT_BINS]; // Waits, WAIT_BIN frames a bin.
+};
+
+// Pedestrians at one crossing.
+struct Kerb {
+    uint64_t rng;               // Random stream.
+    double next;                // Frame of the next arrival.
+    uint32_t arrived[PED_QUEUE]; // Frames of arrival of those waiting.
+    unsigned count;             // Pedestrians waiting.
+    int walk;                   // WALK was on in the last frame.
+};
+
+// Options.
+int jobs = 0;
+long hours = 4096;
+uint64_t seed = 1;
+const char *csvName = 0;
+
+// Values of each dimension of the sweep.
+int values[DIMS][MAX_VALUES];
+int numValues[DIMS];
+long configs = 1;
+int tasks = 1; // Tasks per configuration.
+
+// Driver only.
+struct Result *slots = 0;  // One per job, in shared memory.
+pid_t *slotPids = 0;       // Child using each slot, 0 if free.
+long *slotConfigs = 0;     // Configuration of the child in each slot.
+struct Result *totals = 0; // One per configuration.
+int running = 0;
+
+// -----------------------------------
+// Models of the pelican.c interface
+// -----------------------------------
+
+// Signals that are on, one bit per PelicanSignal, per crossing.
+unsigned lit[CROSSINGS];
+
+// ADC counts drawn by each lamp.
+const unsigned LampCounts[6] = {400, 380, 420, 300, 310, 250};
+
+// Pending button press, per crossing.
+int pressed[CROSSINGS];
+
+void SignalSet(int n, enum PelicanSignal ps) {
+    lit[n] |= 1U << ps;
+}
+
+void SignalReset(int n, enum PelicanSignal ps) {
+    lit[n] &= ~(1U << ps);
+}
+
+void SignalWrite(int n, unsigned mask) {
+    lit[n] = mask;
+}
+
+void SignalCommit(int n) {
+}
+
+void SignalResetAll(int n) {
+    lit[n] = 0;
+}
+
+void SignalSafe(int n, uint32_t detected) {
+    lit[n] = 0;
+}
+
+unsigned Measure(int n) {
+    unsigned sum = 0;
+    int ps;
+
+    for (ps = RED_S; ps <= WAIT_S; ps++)
+        if (lit[n] & (1U << ps))
+            sum = sum + LampCounts[ps];
+
+    return sum;
+}
+
+uint32_t SysTickNow(void) {
+    return 0;
+}
+
+volatile uint32_t ButtonTime[CROSSINGS];
+
+int ButtonTestReset(int n) {
+    int res = pressed[n];
+
+    pressed[n] = 0;
+    return res;
+}
+
+void ButtonClear(int n) {
+    pressed[n] = 0;
+}
+
+int ClockSetProfile(enum ClockProfile profile) {
+    return 0;
+}
+
+uint32_t StampNow(void) {
+    return 0;
+}
+
+void TraceRecord(unsigned type, unsigned state, uint32_t value) {
+}
+
+#if CALIB_CACHE
+void CalibStore(struct Crossing *c) {
+}
+
+void CalibDrop(struct Crossing *c) {
+}
+#else
+void CalibBoot(struct Crossing *c, int warm) {
+}
+#endif
+
+// -----------------------------------
+// Configurations
+// -----------------------------------
+
+// Value of dimension 'dim' in configuration 'config'.
+static int configValue(long config, int dim) {
+    int d;
+
+    for (d = DIMS - 1; d > dim; d--)
+        config = config / numValues[d];
+
+    return values[dim][config % numValues[dim]];
+}
+
+// Parse a list of values and ranges into dimension 'dim'. Returns 0 if the
+// list is not valid.
+static int parseValues(int dim, const char *s) {
+    int max = (dim < TIMINGS) ? 255 : 1000000;
+
+    numValues[dim] = 0;
+    while (*s) {
+        char *end;
+        long lo = strtol(s, &end, 10), hi = lo, step = 1, v;
+
+        if (end == s)
+            return 0;
+        if (*end == ':') {
+            s = end + 1;
+            hi = strtol(s, &end, 10);
+            if (end == s)
+                return 0;
+            if (*end == ':') {
+                s = end + 1;
+                step = strtol(s, &end, 10);
+                if (end == s || step <= 0)
+                    return 0;
+            }
+        }
+        if (*end == ',')
+            end++;
+        else if (*end)
+            return 0;
+        s = end;
+
+        // A timing of 0 would make its state wait for the button.
+        if (lo < 1 || hi < lo || hi > max)
+            return 0;
+
+        for (v = lo; v <= hi; v += step) {
+            if (numValues[dim] == MAX_VALUES)
+                return 0;
+            values[dim][numValues[dim]++] = (int) v;
+        }
+    }
+
+    return numValues[dim] > 0;
+}
+
+// -----------------------------------
+// Simulation
+// -----------------------------------
+
+// Next number of a random stream (xorshift64*).
+static uint64_t rngNext(uint64_t *s) {
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 0x2545f4914f6cdd1dULL;
+}
+
+// Seed of a random stream from a few integers (splitmix64).
+static uint64_t rngSeed(uint64_t a, uint64_t b, uint64_t c) {
+    uint64_t z = a ^ (b * 0x9e3779b97f4a7c15ULL) ^ (c * 0xbf58476d1ce4e5b9ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z = z ^ (z >> 31);
+    return (z) ? z : 1;
+}
+
+// Frames from one arrival to the next, at 'rate' an hour.
+static double interArrival(struct Kerb *k, int rate) {
+    double u = ((rngNext(&k->rng) >> 11) + 1) * (1.0 / 9007199254740992.0);
+
+    return -log(u) * FRAMES_PER_HOUR / rate;
+}
+
+// Pedestrians who arrive by frame 'f' of crossing 'n'.
+static void arrive(struct Kerb *k, int n, uint32_t f, int rate,
+        struct Result *r) {
+    while (k->next <= f) {
+        k->next = k->next + interArrival(k, rate);
+        r->arrivals++;
+
+        if (lit[n] & SIG(WALK_S)) {
+            r->crossed++;
+            r->hist[0]++;
+        } else if (k->count < PED_QUEUE) {
+            k->arrived[k->count++] = f;
+        } else {
+            r->overflows++;
+        }
+    }
+
+    // Nobody has asked to cross, as far as those waiting can see.
+    if (k->count && !(lit[n] & SIG(WAIT_S)) && !pressed[n]) {
+        pressed[n] = 1;
+        r->presses++;
+    }
+}
+
+// Account for frame 'f' of crossing 'n', once it has run.
+static void account(struct Kerb *k, int n, uint32_t f, struct Result *r) {
+    int walk = (lit[n] & SIG(WALK_S)) != 0;
+    unsigned i;
+
+    if (lit[n] & SIG(GREEN_S))
+        r->green++;
+    if (Crossings[n].state != GREENON)
+        r->cycle++;
+
+    // WALK on: all those waiting cross.
+    if (walk && !k->walk) {
+        r->walks++;
+        for (i = 0; i < k->count; i++) {
+            uint32_t wait = f - k->arrived[i];
+            uint32_t bin = wait / WAIT_BIN;
+
+            r->hist[(bin < WAIT_BINS) ? bin : WAIT_BINS - 1]++;
+            r->waitSum += wait;
+            if (wait > r->waitMax)
+                r->waitMax = wait;
+        }
+        r->crossed += k->count;
+        k->count = 0;
+    }
+
+    k->walk = walk;
+}
+
+// Child: run task 'task' of configuration 'config' into 'r'.
+static void runTask(long config, int task, struct Result *r) {
+    static struct Kerb kerbs[CROSSINGS];
+    int rate = configValue(config, TIMINGS);
+    uint32_t f, frames = TASK_HOURS * FRAMES_PER_HOUR;
+    int t, i, n;
+
+    memset(r, 0, sizeof *r);
+
+    for (t = 0; t < TIMINGS; t++)
+        for (i = 0; i < 2; i++)
+            if (TimingRows[t][i] >= 0)
+                StmTable[TimingRows[t][i]].seconds = configValue(config, t);
+
+    // Initiation, ended by a press, up to the first GREENON.
+    for (n = 0; n < CROSSINGS; n++) {
+        CrossingInit(&Crossings[n], n);
+        lit[n] = 0;
+        pressed[n] = 1;
+    }
+    for (f = 0; Crossings[0].state != GREENON; f++) {
+        if (f == WARMUP_FRAMES) {
+            fprintf(stderr, "initiation did not end\n");
+            _exit(1);
+        }
+        executeFrame(Crossings, CROSSINGS);
+    }
+
+    for (n = 0; n < CROSSINGS; n++) {
+        kerbs[n].rng = rngSeed(seed, config, (uint64_t) task * CROSSINGS + n);
+        kerbs[n].next = interArrival(&kerbs[n], rate);
+        kerbs[n].count = 0;
+        kerbs[n].walk = 0;
+    }
+
+    for (f = 0; f < frames; f++) {
+        for (n = 0; n < CROSSINGS; n++)
+            arrive(&kerbs[n], n, f, rate, r);
+
+        executeFrame(Crossings, CROSSINGS);
+
+        for (n = 0; n < CROSSINGS; n++)
+            account(&kerbs[n], n, f, r);
+    }
+
+    r->frames = (uint64_t) frames * CROSSINGS;
+}
+
+// -----------------------------------
+// Tasks
+// -----------------------------------
+
+// Add a task result to the totals of its configuration.
+static void addResult(struct Result *total, const struct Result *r) {
+    int i;
+
+    total->frames += r->frames;
+    total->green += r->green;
+    total->cycle += r->cycle;
+    total->walks += r->walks;
+    total->arrivals += r->arrivals;
+    total->crossed += r->crossed;
+    total->presses += r->presses;
+    total->overflows += r->overflows;
+    total->waitSum += r->waitSum;
+    if (r->waitMax > total->waitMax)
+        total->waitMax = r->waitMax;
+    for (i = 0; i < WAIT_BINS; i++)
+        total->hist[i] += r->hist[i];
+}
+
+// Wait for one child to end and take its result.
+static void reap(void) {
+    int status, s;
+    pid_t pid = wait(&status);
+
+    if (pid < 0) {
+        perror("wait");
+        exit(1);
+    }
+
+    for (s = 0; s < jobs && slotPids[s] != pid; s++)
+        ;
+    if (s == jobs)
+        return;
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "task of configuration %ld failed\n", slotConfigs[s]);
+        exit(1);
+    }
+
+    addResult(&totals[slotConfigs[s]], &slots[s]);
+    slotPids[s] = 0;
+    running--;
+}
+
+// Fork a child for a task, once a slot is free.
+static void start(long config, int task) {
+    pid_t pid;
+    int s;
+
+    while (running >= jobs)
+        reap();
+
+    for (s = 0; slotPids[s] != 0; s++)
+        ;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+
+    if (pid == 0) {
+        runTask(config, task, &slots[s]);
+        _exit(0);
+    }
+
+    slotPids[s] = pid;
+    slotConfigs[s] = config;
+    running++;
+}
+
+// -----------------------------------
+// Report
+// -----------------------------------
+
+// Wait of the p'th percentile of those who crossed, in s.
+static double percentile(const struct Result *r, int p) {
+    uint64_t target = (r->crossed * p + 99) / 100, sum = 0;
+    int i;
+
+    for (i = 0; i < WAIT_BINS - 1; i++) {
+        sum += r->hist[i];
+        if (sum >= target)
+            break;
+    }
+
+    return (double) i * WAIT_BIN / CYCLESPERSEC;
+}
+
+// Mean wait of those who crossed, in s. Those who found WALK on count 0.
+static double meanWait(const struct Result *r) {
+    return (r->crossed) ?
+        (double) r->waitSum / r->crossed / CYCLESPERSEC : 0;
+}
+
+static void report(double seconds) {
+    double crossingHours = (double) configs * tasks * CROSSINGS * TASK_HOURS;
+    uint64_t overflows = 0;
+    long c;
+    int d;
+
+    printf("%ld configurations, %.0f crossing-hours, %d jobs, %.1f s, "
+            "%.0f crossing-hours/s\n\n", configs, crossingHours, jobs,
+            seconds, crossingHours / seconds);
+
+    for (d = 0; d < TIMINGS; d++)
+        printf("%3s ", DimNames[d]);
+    printf("%6s %7s %9s %6s %6s %6s %6s %6s %6s %6s\n", "rate", "walks/h",
+            "crossed/h", "mean", "p50", "p90", "p99", "max", "green",
+            "cycle");
+
+    for (c = 0; c < configs; c++) {
+        const struct Result *r = &totals[c];
+        double h = (double) r->frames / FRAMES_PER_HOUR;
+
+        for (d = 0; d < TIMINGS; d++)
+            printf("%3d ", configValue(c, d));
+        printf("%6d %7.1f %9.1f %6.1f %6.1f %6.1f %6.1f %6.1f %5.1f%% "
+                "%5.1f%%\n", configValue(c, TIMINGS), r->walks / h,
+                r->crossed / h, meanWait(r), percentile(r, 50),
+                percentile(r, 90), percentile(r, 99),
+                (double) r->waitMax / CYCLESPERSEC,
+                100.0 * r->green / r->frames, 100.0 * r->cycle / r->frames);
+        overflows += r->overflows;
+    }
+
+    printf("\nrate: pedestrians an hour at each crossing; waits in s, "
+            "from arrival to WALK\n"
+            "green: time with GREEN on; cycle: time out of GREENON\n");
+    if (overflows)
+        printf("%llu pedestrians not kept, as %d were waiting\n",
+                (unsigned long long) overflows, PED_QUEUE);
+}
+
+static void writeCsv(const char *name) {
+    FILE *f = fopen(name, "w");
+    long c;
+    int d;
+
+    if (f == 0) {
+        perror(name);
+        exit(1);
+    }
+
+    fprintf(f, "t1,t2,t3,t4,t5,t6,t7,rate,hours,walks_per_h,crossed_per_h,"
+            "wait_mean_s,wait_p50_s,wait_p90_s,wait_p99_s,wait_max_s,"
+            "green,cycle\n");
+    for (c = 0; c < configs; c++) {
+        const struct Result *r = &totals[c];
+        double h = (double) r->frames / FRAMES_PER_HOUR;
+
+        for (d = 0; d < DIMS; d++)
+            fprintf(f, "%d,", configValue(c, d));
+        fprintf(f, "%.0f,%.3f,%.3f,%.3f,%.2f,%.2f,%.2f,%.2f,%.5f,%.5f\n", h,
+                r->walks / h, r->crossed / h, meanWait(r), percentile(r, 50),
+                percentile(r, 90), percentile(r, 99),
+                (double) r->waitMax / CYCLESPERSEC,
+                (double) r->green / r->frames,
+                (double) r->cycle / r->frames);
+    }
+
+    fclose(f);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-j jobs] [-h hours] [-r rates] "
+            "[-T n=values]... [-s seed] [-o csv]\n", name);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    struct timespec startTime, end;
+    long c;
+    int opt, d, t;
+
+    for (d = 0; d < DIMS; d++) {
+        values[d][0] = Defaults[d];
+        numValues[d] = 1;
+    }
+
+    while ((opt = getopt(argc, argv, "j:h:r:T:s:o:")) != -1) {
+        switch (opt) {
+            case 'j': jobs = atoi(optarg); break;
+            case 'h': hours = atol(optarg); break;
+            case 'r':
+                if (!parseValues(TIMINGS, optarg))
+                    usage(argv[0]);
+                break;
+            case 'T':
+                d = optarg[0] - '1';
+                if (d < 0 || d >= TIMINGS || optarg[1] != '='
+                        || !parseValues(d, optarg + 2))
+                    usage(argv[0]);
+                break;
+            case 's': seed = strtoull(optarg, 0, 10); break;
+            case 'o': csvName = optarg; break;
+            default: usage(argv[0]);
+        }
+    }
+
+    if (jobs <= 0)
+        jobs = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (jobs <= 0)
+        jobs = 1;
+    if (hours <= 0)
+        hours = 1;
+    tasks = (hours + CROSSINGS * TASK_HOURS - 1) / (CROSSINGS * TASK_HOURS);
+    for (d = 0; d < DIMS; d++)
+        configs = configs * numValues[d];
+
+    slots = mmap(0, jobs * sizeof *slots, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    slotPids = calloc(jobs, sizeof *slotPids);
+    slotConfigs = calloc(jobs, sizeof *slotConfigs);
+    totals = calloc(configs, sizeof *totals);
+    if (slots == MAP_FAILED || !slotPids || !slotConfigs || !totals) {
+        fprintf(stderr, "out of memory for %ld configurations\n", configs);
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+
+    for (c = 0; c < configs; c++)
+        for (t = 0; t < tasks; t++)
+            start(c, t);
+    while (running > 0)
+        reap();
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    report((end.tv_sec - startTime.tv_sec) +
+            (end.tv_nsec - startTime.tv_nsec) / 1e9);
+    if (csvName)
+        writeCsv(csvName);
+
+    return 0;
+}
@@ -0,0 +1,210 @@
+/* -------------------------------------
+ * Decoder of the STM trace (../src/trace.c).
+ *
+ * Reads the bytes sent by UART0, from a capture of the OpenSDA serial port
+ * or from pelican_sim -t, and prints one line per record: the time since
+ * reset and since the previous record, in seconds, the record type, the
+ * state and the value. Probe readings are printed in mV. The records of a
+ * crossing other than 0 have its number after their type, as PROBE/1.
+ *
+ * Build and run from this directory:
+ *
+ *   gcc -O2 -I. -I../include -o trace_decode trace_decode.c trace_read.c \
+ *       vcd.c
+ *   ./trace_decode [-n records] [-v vcd] [trace]
+ *
+ * The trace is read from standard input if no file is given. With -n only
+ * the failures are printed, each after the 'records' records before it.
+ * With -v the records of crossing 0 are written to a VCD file instead: the
+ * signals of each state (all off after a failure), the button, held for the
+ * debounce time from the record of each press, the state and the probe
+ * readings.
+ *
+ * Decoding starts at the first sync record. A byte that cannot start a
+ * record loses the place; the bytes up to the next sync record are skipped
+ * and counted. The output ends with the records of each type.
+ * -------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "MKL25Z4.H"
+#include "pelican.h"
+#include "stm.h"
+#include "trace.h"
+#include "trace_read.h"
+#include "vcd.h"
+
+#define LINE_MAX (96)
+
+static int context = -1; // -n: records before each failure, -1 for all.
+
+// The last 'context' lines, for -n.
+static char (*history)[LINE_MAX];
+static unsigned historyCount = 0;
+
+static unsigned long counts[TRACE_TYPES];
+static unsigned long lost = 0;
+
+// Waveforms, with -v.
+static FILE *vcdFile = NULL;
+static struct VcdWriter vcd;
+static struct VcdValues values;
+static uint64_t buttonOff = 0; // End of the button pulse, in us.
+
+// Print a line, or with -n keep it until the next failure.
+static void emit(const char *line, int failure) {
+    unsigned i;
+
+    if (context < 0) {
+        fputs(line, stdout);
+        return;
+    }
+
+    if (failure) {
+        for (i = 0; i < historyCount; i++)
+            fputs(history[i], stdout);
+        fputs(line, stdout);
+        puts("--");
+        historyCount = 0;
+        return;
+    }
+
+    if (context == 0)
+        return;
+    if (historyCount == (unsigned) context) {
+        for (i = 1; i < historyCount; i++)
+            memcpy(history[i - 1], history[i], LINE_MAX);
+        historyCount--;
+    }
+    memcpy(history[historyCount++], line, LINE_MAX);
+}
+
+// Write the values after a record of crossing 0.
+static void wave(const struct TraceEntry *e) {
+    if (e->crossing != 0)
+        return;
+
+    // The button pulse that ended before this record.
+    if (values.button && e->time >= buttonOff) {
+        values.button = 0;
+        VcdWrite(&vcd, buttonOff, &values);
+    }
+
+    switch (e->type) {
+        case TRACE_STATE:
+            values.state = e->state;
+            values.outputs = TraceStateOutputs[e->state];
+            break;
+        case TRACE_PROBE:
+            values.probe = (double) e->value * VREF_MV
+                / (ADCRANGE * PROBE_SCALE);
+            break;
+        case TRACE_BUTTON:
+        case TRACE_PRESS:
+            values.button = 1;
+            buttonOff = e->time + BUTTON_DELAY * 1000;
+            break;
+        case TRACE_FAILURE:
+            values.outputs = 0; // Until the next state.
+            break;
+    }
+
+    // The first state is the one of the first record that has one.
+    if (values.state < 0 && e->type != TRACE_LOST && e->type != TRACE_ADC
+            && e->type != TRACE_PRESS && e->type != TRACE_BOOT) {
+        values.state = e->state;
+        values.outputs = TraceStateOutputs[e->state];
+    }
+
+    if (values.state >= 0)
+        VcdWrite(&vcd, e->time, &values);
+}
+
+int main(int argc, char *argv[]) {
+    struct TraceReader reader;
+    struct TraceEntry e;
+    char line[LINE_MAX];
+    FILE *in = stdin;
+    uint64_t end = 0;
+    int opt, c;
+    unsigned type;
+
+    while ((opt = getopt(argc, argv, "n:v:")) != -1) {
+        switch (opt) {
+            case 'n': context = atoi(optarg); break;
+            case 'v':
+                if ((vcdFile = fopen(optarg, "w")) == NULL) {
+                    perror(optarg);
+                    return 1;
+                }
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-n records] [-v vcd] [trace]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind < argc && (in = fopen(argv[optind], "rb")) == NULL) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    if (context > 0)
+        history = malloc((size_t) context * LINE_MAX);
+    if (context > 0 && history == NULL) {
+        perror("malloc");
+        return 1;
+    }
+
+    TraceReaderInit(&reader);
+    if (vcdFile) {
+        VcdOpen(&vcd, vcdFile, "trace_decode", 0);
+        values.state = -1;
+    }
+
+    while ((c = getc(in)) != EOF) {
+        if (!TraceReaderPut(&reader, (uint8_t) c, &e))
+            continue;
+
+        counts[e.type]++;
+        if (e.type == TRACE_LOST)
+            lost += e.value;
+
+        if (vcdFile) {
+            wave(&e);
+            end = e.time;
+            continue;
+        }
+
+        TraceFormat(line, sizeof line, &e);
+        emit(line, e.type == TRACE_FAILURE);
+    }
+
+    if (vcdFile) {
+        if (values.button) {
+            values.button = 0;
+            VcdWrite(&vcd, buttonOff, &values);
+        }
+        VcdEnd(&vcd, end);
+        fclose(vcdFile);
+    }
+
+    printf("\nrecords:");
+    for (type = TRACE_STATE; type < TRACE_TYPES; type++)
+        if (type <= TRACE_LOST || counts[type] != 0)
+            printf(" %s %lu", TraceTypeNames[type], counts[type]);
+    printf("\nsync records %lu, resyncs %lu, bytes skipped %lu, "
+            "records lost %lu\n", reader.syncs, reader.resyncs,
+            reader.skipped, lost);
+
+    if (in != stdin)
+        fclose(in);
+    free(history);
+
+    return 0;
+}
@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include "MKL25Z4.H"
+#include "pelican.h"
+#include "stm.h"
+#include "trace.h"
+#include "trace_read.h"
+
+// -----------------------------------
+// Trace reader: a decoder of the trace byte stream.
+// -----------------------------------
+
+// Parts of the stream.
+enum {
+    READ_HUNT,   // Looking for TRACE_SYNC_0.
+    READ_SYNC_1, // TRACE_SYNC_0 seen.
+    READ_STAMP,  // Time of a sync record.
+    READ_TYPE,
+    READ_DELTA,
+    READ_STATE,
+    READ_VALUE
+};
+
+const char *const TraceTypeNames[TRACE_TYPES] = {
+    "", "STATE", "PROBE", "BUTTON", "FAILURE", "LOST", "FRAME", "ADC", "PRESS",
+    "BOOT"
+};
+
+// As SimStateNames in sim.c, for the tools that do not link the simulator.
+const char *const TraceStateNames[NUMSTATES] = {
+    "REDINIT", "AMBERINIT", "AMBERFAILUREINIT", "GREENINIT", "DONTWALKINIT",
+    "WALKINIT", "WAITINIT", "REDANDDONTWALK", "WAITFLASHINGON",
+    "WAITFLASHINGOFF", "GREENON", "WAITON", "AMBERON", "AMBERFAILURE",
+    "REDON", "WALKON", "DONTWALKON", "AMBERANDREDON", "AMBERFAILUREANDREDON"
+};
+
+// The outputs of the rows of StmTable in stm.c.
+const unsigned TraceStateOutputs[NUMSTATES] = {
+    SIG(RED_S), SIG(AMBER_S), SIG(RED_S), SIG(GREEN_S), SIG(DONTWALK_S),
+    SIG(WALK_S), SIG(WAIT_S), SIG(RED_S) | SIG(DONTWALK_S), SIG(WAIT_S), 0,
+    SIG(GREEN_S) | SIG(DONTWALK_S),
+    SIG(GREEN_S) | SIG(DONTWALK_S) | SIG(WAIT_S),
+    SIG(AMBER_S) | SIG(DONTWALK_S) | SIG(WAIT_S),
+    SIG(RED_S) | SIG(DONTWALK_S) | SIG(WAIT_S),
+    SIG(RED_S) | SIG(DONTWALK_S) | SIG(WAIT_S),
+    SIG(RED_S) | SIG(WALK_S), SIG(RED_S) | SIG(DONTWALK_S),
+    SIG(RED_S) | SIG(AMBER_S) | SIG(DONTWALK_S), SIG(RED_S) | SIG(DONTWALK_S)
+};
+
+static const char *const checkNames[] = {"none", "calibrate", "red", "amber"};
+
+void TraceReaderInit(struct TraceReader *r) {
+    r->phase = READ_HUNT;
+    r->shift = 0;
+    r->stamp = 0;
+    r->synced = 0;
+    r->entry.time = 0;
+    r->syncs = 0;
+    r->resyncs = 0;
+    r->skipped = 0;
+}
+
+// The record types that carry a state.
+static int hasState(unsigned type) {
+    return type <= TRACE_FAILURE || type == TRACE_FRAME;
+}
+
+// Lost the place: look for the next sync record.
+static void lose(struct TraceReader *r) {
+    r->resyncs++;
+    r->synced = 0;
+    r->phase = READ_HUNT;
+}
+
+// Add 7 bits to a varint.
+//   Return: 1 if it was the last byte, 0 if more follow, -1 if too long
+static int varint(struct TraceReader *r, uint32_t *v, uint8_t byte) {
+    if (r->shift == 0)
+        *v = 0;
+    if (r->shift >= 35)
+        return -1;
+
+    *v |= (uint32_t) (byte & 0x7f) << r->shift;
+    r->shift += 7;
+    if (byte & 0x80)
+        return 0;
+
+    r->shift = 0;
+    return 1;
+}
+
+int TraceReaderPut(struct TraceReader *r, uint8_t byte,
+        struct TraceEntry *e) {
+    struct TraceEntry *n = &r->entry;
+    uint32_t delta;
+    int done;
+
+    switch (r->phase) {
+        case READ_HUNT:
+            if (byte == TRACE_SYNC_0)
+                r->phase = READ_SYNC_1;
+            else
+                r->skipped++;
+            return 0;
+
+        case READ_SYNC_1:
+            if (byte == TRACE_SYNC_1) {
+                r->phase = READ_STAMP;
+                r->shift = 0;
+                r->stamp = 0;
+            } else {
+                r->skipped += (byte == TRACE_SYNC_0) ? 1 : 2;
+                r->phase = (byte == TRACE_SYNC_0) ? READ_SYNC_1 : READ_HUNT;
+            }
+            return 0;
+
+        case READ_STAMP:
+            r->stamp |= (uint32_t) byte << r->shift;
+            r->shift += 8;
+            if (r->shift < 32)
+                return 0;
+
+            // StampNow() wraps every 71 minutes; a sync record follows at
+            // least every second, so the stamp is ahead of the last time.
+            delta = r->stamp - (uint32_t) n->time;
+            if (r->synced && delta > 0x80000000u)
+                delta = 0;
+            n->time += delta;
+            r->synced = 1;
+            r->syncs++;
+            r->shift = 0;
+            r->phase = READ_TYPE;
+            return 0;
+
+        case READ_TYPE:
+            if (byte == TRACE_SYNC_0) {
+                r->phase = READ_SYNC_1;
+            } else if ((byte & 0x0f) >= TRACE_STATE
+                    && (byte & 0x0f) < TRACE_TYPES
+                    && (byte >> 4) < TRACE_CROSSINGS) {
+                n->type = byte & 0x0f;
+                n->crossing = byte >> 4;
+                r->phase = READ_DELTA;
+            } else {
+                lose(r);
+                r->skipped++;
+            }
+            return 0;
+
+        case READ_DELTA:
+            done = varint(r, &n->delta, byte);
+            if (done < 0)
+                lose(r);
+            else if (done)
+                r->phase = READ_STATE;
+            return 0;
+
+        case READ_STATE:
+            n->state = byte;
+            if (hasState(n->type) && byte >= NUMSTATES)
+                lose(r);
+            else
+                r->phase = READ_VALUE;
+            return 0;
+
+        case READ_VALUE:
+            done = varint(r, &n->value, byte);
+            if (done < 0) {
+                lose(r);
+                return 0;
+            }
+            if (!done)
+                return 0;
+
+            n->time += n->delta;
+            r->phase = READ_TYPE;
+            *e = *n;
+            return 1;
+    }
+
+    return 0;
+}
+
+void TraceFormat(char *line, size_t size, const struct TraceEntry *e) {
+    const char *name = (hasState(e->type)) ? TraceStateNames[e->state] : "";
+    char type[16];
+    int n;
+
+    // The crossing of a record is only shown if not 0.
+    snprintf(type, sizeof type, (e->crossing) ? "%s/%u" : "%s",
+            TraceTypeNames[e->type], e->crossing);
+    n = snprintf(line, size, "%12.6f %+10.6f  %-8s %-20s ", e->time / 1e6,
+            e->delta / 1e6, type, name);
+    if (n < 0 || (size_t) n >= size)
+        return;
+
+    line += n;
+    size -= n;
+
+    switch (e->type) {
+        case TRACE_STATE:
+            snprintf(line, size, "from %s\n", (e->value < NUMSTATES)
+                    ? TraceStateNames[e->value] : "?");
+            break;
+        case TRACE_PROBE:
+            snprintf(line, size, "%7.1f mV\n",
+                    (double) e->value * VREF_MV / (ADCRANGE * PROBE_SCALE));
+            break;
+        case TRACE_BUTTON:
+            snprintf(line, size, "waited %.3f ms\n", e->value / 1e3);
+            break;
+        case TRACE_FAILURE:
+            snprintf(line, size, "%s check\n",
+                    (e->value < 4) ? checkNames[e->value] : "?");
+            break;
+        case TRACE_LOST:
+            snprintf(line, size, "%lu records\n", (unsigned long) e->value);
+            break;
+        case TRACE_FRAME:
+            snprintf(line, size, "%lu ticks\n", (unsigned long) e->value);
+            break;
+        case TRACE_ADC:
+            snprintf(line, size, "%lu counts\n", (unsigned long) e->value);
+            break;
+        case TRACE_PRESS:
+            snprintf(line, size, "%.3f ms ago\n", e->value / 1e3);
+            break;
+        case TRACE_BOOT:
+            snprintf(line, size, "%s, %.3f ms\n",
+                    (e->state) ? "from the cache" : "calibrated",
+                    e->value / 1e3);
+            break;
+    }
+}
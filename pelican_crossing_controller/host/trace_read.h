@@ -0,0 +1,61 @@
+#ifndef __TRACE_READ_H
+#define __TRACE_READ_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// -----------------------------------
+// Trace reader
+//
+// Decodes the byte stream of ../src/trace.c, one byte at a time, so that it
+// can be fed from a file or from the simulated UART. Decoding starts at the
+// first sync record. A byte that cannot start a record loses the place; the
+// bytes up to the next sync record are skipped and counted.
+// -----------------------------------
+
+// Record types: TRACE_STATE to TRACE_BOOT, as in trace.h.
+#define TRACE_TYPES (TRACE_BOOT + 1)
+
+// A decoded record.
+struct TraceEntry {
+    unsigned type;
+    unsigned crossing; // Of a record of the STM, from its type byte.
+    unsigned state;
+    uint32_t value;
+    uint32_t delta; // us since the previous record.
+    uint64_t time;  // us since reset, over the wraps of StampNow().
+};
+
+struct TraceReader {
+    int phase;          // Part of the record the next byte belongs to.
+    unsigned shift;     // Bits of the varint read so far.
+    uint32_t stamp;     // Sync record time being read.
+    int synced;         // The time is known.
+    struct TraceEntry entry;
+    unsigned long syncs;
+    unsigned long resyncs;
+    unsigned long skipped;
+};
+
+// Names of the record types and of the states.
+extern const char *const TraceTypeNames[TRACE_TYPES];
+extern const char *const TraceStateNames[];
+
+// Signals that each state turns on, as SIG() masks. The trace records the
+// states, not the outputs.
+extern const unsigned TraceStateOutputs[];
+
+// Start decoding a stream.
+extern void TraceReaderInit(struct TraceReader *r);
+
+// Decode one byte.
+//   Param: reader, byte, record filled in when it is complete
+//   Return: 1 if the byte completed a record, 0 otherwise
+extern int TraceReaderPut(struct TraceReader *r, uint8_t byte,
+        struct TraceEntry *e);
+
+// Print a record as a timeline line, with its newline.
+//   Param: buffer, its size, record
+extern void TraceFormat(char *line, size_t size, const struct TraceEntry *e);
+
+#endif
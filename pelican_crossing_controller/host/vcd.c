@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include "MKL25Z4.H"
+#include "pelican.h"
+#include "stm.h"
+#include "trace.h"
+#include "trace_read.h"
+#include "vcd.h"
+
+// -----------------------------------
+// VCD writer
+// -----------------------------------
+
+// Identifier codes of the variables: the six signals, then the others.
+#define VCD_BUTTON '\''
+#define VCD_STATE '('
+#define VCD_STATE_NAME ')'
+#define VCD_COUNTER '*'
+#define VCD_PROBE '+'
+
+#define STATE_BITS (5) // Bits of the state variable.
+
+#if NUMSTATES > (1 << STATE_BITS)
+#error "STATE_BITS is too small for NUMSTATES"
+#endif
+
+static const char *const signalNames[6] = {
+    "red", "amber", "green", "dontwalk", "walk", "wait"
+};
+
+void VcdOpen(struct VcdWriter *v, FILE *f, const char *program,
+        int counter) {
+    int ps;
+
+    v->f = f;
+    v->counter = counter;
+    v->started = 0;
+    v->time = 0;
+
+    fprintf(f, "$version %s $end\n", program);
+    fprintf(f, "$timescale 1us $end\n");
+    fprintf(f, "$scope module pelican $end\n");
+    for (ps = 0; ps < 6; ps++)
+        fprintf(f, "$var wire 1 %c %s $end\n", '!' + ps, signalNames[ps]);
+    fprintf(f, "$var wire 1 %c button $end\n", VCD_BUTTON);
+    fprintf(f, "$var wire %d %c state $end\n", STATE_BITS, VCD_STATE);
+    fprintf(f, "$var string 1 %c state_name $end\n", VCD_STATE_NAME);
+    if (counter)
+        fprintf(f, "$var integer 16 %c SysTickCounter $end\n", VCD_COUNTER);
+    fprintf(f, "$var real 64 %c probe_mv $end\n", VCD_PROBE);
+    fprintf(f, "$upscope $end\n");
+    fprintf(f, "$enddefinitions $end\n");
+}
+
+// Write a value as binary, without the leading zeros, which viewers add
+// back up to the width of the variable.
+static void vector(FILE *f, uint32_t value, char id) {
+    int bit = 31;
+
+    while (bit > 0 && !((value >> bit) & 1))
+        bit--;
+
+    fputc('b', f);
+    for (; bit >= 0; bit--)
+        fputc((value >> bit) & 1 ? '1' : '0', f);
+    fprintf(f, " %c\n", id);
+}
+
+void VcdWrite(struct VcdWriter *v, uint64_t time,
+        const struct VcdValues *values) {
+    const struct VcdValues *last = &v->last;
+    FILE *f = v->f;
+    int all = !v->started;
+    unsigned outputs = values->outputs ^ last->outputs;
+    int button = all || values->button != last->button;
+    int state = all || values->state != last->state;
+    int counter = v->counter && (all || values->counter != last->counter);
+    int probe = all || values->probe != last->probe;
+    int ps;
+
+    if (all)
+        outputs = 0x3f;
+    if (!outputs && !button && !state && !counter && !probe)
+        return;
+
+    // The time goes before the first change at a new time.
+    if (all || time != v->time)
+        fprintf(f, "#%llu\n", (unsigned long long) time);
+
+    for (ps = 0; ps < 6; ps++)
+        if (outputs & (1U << ps))
+            fprintf(f, "%d%c\n", (values->outputs >> ps) & 1, '!' + ps);
+
+    if (button)
+        fprintf(f, "%d%c\n", values->button != 0, VCD_BUTTON);
+
+    if (state) {
+        vector(f, values->state, VCD_STATE);
+        fprintf(f, "s%s %c\n", (values->state >= 0 && values->state
+                    < NUMSTATES) ? TraceStateNames[values->state] : "?",
+                VCD_STATE_NAME);
+    }
+
+    if (counter)
+        vector(f, (uint32_t) values->counter, VCD_COUNTER);
+
+    if (probe)
+        fprintf(f, "r%.6g %c\n", values->probe, VCD_PROBE);
+
+    v->time = time;
+    v->started = 1;
+    v->last = *values;
+}
+
+void VcdEnd(struct VcdWriter *v, uint64_t time) {
+    if (time > v->time)
+        fprintf(v->f, "#%llu\n", (unsigned long long) time);
+}
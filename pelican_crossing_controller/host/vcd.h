@@ -0,0 +1,49 @@
+#ifndef __VCD_H
+#define __VCD_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// -----------------------------------
+// VCD writer
+//
+// Writes the signals of the controller as a Value Change Dump, for GTKWave
+// and other waveform viewers. Each call gives the values at a time; only
+// the values that changed are written, and nothing is kept but the last
+// values, so a run of any length streams to the file in constant memory.
+// -----------------------------------
+
+// Values at one time.
+struct VcdValues {
+    unsigned outputs; // Signals that are on, one bit per PelicanSignal.
+    int button;       // CROSSING button input.
+    int state;        // STM state.
+    int counter;      // SysTickCounter.
+    double probe;     // Probe point voltage, in mV.
+};
+
+struct VcdWriter {
+    FILE *f;
+    int counter;            // SysTickCounter is written.
+    int started;            // The initial values are written.
+    uint64_t time;          // Time of the last values written, in us.
+    struct VcdValues last;  // Last values written.
+};
+
+// Write the header and the variables.
+//   Param: writer, file, program named in the header, 1 to write
+//          SysTickCounter
+extern void VcdOpen(struct VcdWriter *v, FILE *f, const char *program,
+        int counter);
+
+// Write the values that changed since the last call.
+//   Param: writer, time in us, no earlier than the last call, values
+extern void VcdWrite(struct VcdWriter *v, uint64_t time,
+        const struct VcdValues *values);
+
+// Mark the end of the run, so that viewers show the time after the last
+// change.
+//   Param: writer, time in us
+extern void VcdEnd(struct VcdWriter *v, uint64_t time);
+
+#endif
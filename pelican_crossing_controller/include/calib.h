@@ -0,0 +1,114 @@
+#ifndef __CALIB_H
+#define __CALIB_H
+
+// -----------------------------------
+// Configuration
+// -----------------------------------
+
+// Calibration cache in flash.
+//   0: off, every reset runs the initiation sequence.
+//   1: the lamp readings of the initiation sequence are kept in flash. A
+//      reset that finds them valid checks every lamp and starts in
+//      REDANDDONTWALK.
+// Writing the cache, after an initiation that changed it, masks interrupts
+// and turns every lamp off for a sector erase, 13 ms typical and 114 ms at
+// worst, and the program of each word of the record, 145 us at worst: 116 ms
+// in all with one crossing, 117 ms with two. CalibFlush() writes it from the
+// main loop, between frames, so that it is in neither StmStats nor
+// IdleStats. The SysTick and TPM0 interrupts of that time are taken once at
+// its end, so the frames and StampNow() fall behind by up to as much, once.
+#ifndef CALIB_CACHE
+#define CALIB_CACHE (1)
+#endif
+
+// Sector of the cache: the last 1 KB sector of the 128 KB flash of the
+// KL25Z128. The image must end below it.
+#define CALIB_ADDR (0x0001FC00u)
+#define CALIB_SECTOR (1024) // Bytes erased by one command.
+
+#define CALIB_MAGIC (0x50430001u) // "PC", record version 1.
+#define CALIB_SETTLE (2)          // SysTicks from lighting to sampling.
+
+// Conversions of each step of a spot check. As many as PROBE_SCALE, so
+// that their sum is a reading on the scale of the STM.
+#define CALIB_SAMPLES (PROBE_SCALE)
+
+// Word of program flash at an address. The host tools read their model of
+// the flash instead.
+#ifndef FLASH_WORD
+#define FLASH_WORD(addr) (*(const volatile uint32_t *) (addr))
+#endif
+
+// -----------------------------------
+// Record
+// -----------------------------------
+
+// The record in flash. The CRC covers the words before it; the chip and
+// the configuration must match the board that reads it.
+struct CalibRecord {
+    uint32_t magic;     // CALIB_MAGIC.
+    uint32_t uid[3];    // SIM UIDMH, UIDML and UIDL of the chip.
+    uint32_t config;    // CRC of the pin map and the ADC settings.
+    uint32_t valid;     // Crossings calibrated, one bit each.
+    uint32_t calibrated[CROSSINGS][6]; // As in struct Crossing.
+    uint32_t crc;       // CRC-32 of the words above.
+};
+
+// -----------------------------------
+// Boot
+// -----------------------------------
+
+// Time from reset to operation of each crossing, in us: from the start of
+// TPM0 in PelicanConfig() to the STM entering REDANDDONTWALK with its lamps
+// calibrated. 0 until then.
+extern volatile uint32_t BootTime[CROSSINGS];
+
+// 1 if the crossing started from the cache, 0 if it ran the initiation.
+extern volatile uint8_t BootWarm[CROSSINGS];
+
+// Results of the last flash command of CalibFlush(): FTFA FSTAT.
+extern volatile uint8_t CalibFlashStatus;
+
+struct Crossing;
+
+#if CALIB_CACHE
+// Start the crossings whose calibration is in the cache and passes a spot
+// check of each of their lamps, in REDANDDONTWALK, unless their button is
+// held down at reset. The others are left in REDINIT. Called once the
+// crossings are initialised.
+//   Param: crossings, number of crossings
+extern void CalibLoad(struct Crossing *crossings, int n);
+
+// Mark the calibration of a crossing, at the end of its initiation, to be
+// saved with those of the crossings already running. Called from the frame,
+// which it leaves to CalibFlush() to write the flash.
+//   Param: crossing
+extern void CalibStore(struct Crossing *c);
+
+// Save the calibrations marked since the last call, unless the cache holds
+// them already. Called from the main loop after a frame. Interrupts are
+// masked, and the lamps of every crossing off, while the flash is erased and
+// programmed (see CALIB_CACHE); the frame is left out of IdleStats.
+extern void CalibFlush(void);
+
+// Drop the calibration of a crossing from the cache if the crossing started
+// from it, on a failure detected by the STM: a lamp may have been changed
+// since, so the next reset runs the initiation. CalibFlush() writes it.
+//   Param: crossing
+extern void CalibDrop(struct Crossing *c);
+
+// Crossings whose calibration belongs in the cache, one bit each: those
+// started by CalibLoad() or marked by CalibStore(), less those dropped.
+extern uint32_t CalibValid;
+#else
+#define CalibLoad(crossings, n) ((void) 0)
+#define CalibStore(c) CalibBoot((c), 0)
+#define CalibFlush() ((void) 0)
+#define CalibDrop(c) ((void) 0)
+#endif
+
+// Record the boot time of a crossing, and trace it.
+//   Param: crossing, 1 if from the cache
+extern void CalibBoot(struct Crossing *c, int warm);
+
+#endif
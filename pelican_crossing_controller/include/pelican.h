@@ -1,6 +1,8 @@
 #ifndef __PELICAN_H
 #define __PELICAN_H
 
+#include "sched.h"
+
 // Mask
 #define MASK(x) (1UL << (x))
 
@@ -12,11 +14,53 @@ extern void PelicanConfig(void);
 #define CYCLESYSTICK (50)  // STM cycle in SysTicks (ms).
 #define CYCLESPERSEC (20)  // Implies 20 cycles per second.
 
+// --------------------------
+// Crossings
+// --------------------------
+
+// Number of crossings driven by the board, each with its own signals, probe
+// and button, and its own STM (struct Crossing, stm.h). The I/O functions
+// below take the index of the crossing. More than one crossing needs
+// ADC_SAMPLING_SOFTWARE: the other sampling modes convert a single channel.
+#ifndef CROSSINGS
+#define CROSSINGS (1)
+#endif
+
+// Pins of a crossing.
+struct CrossingPins {
+    uint8_t signal[6]; // Port E pin of each PelicanSignal.
+    uint8_t probe;     // ADC0 channel of the probe point.
+    uint8_t probePos;  // Port B pin of that channel.
+    uint8_t button;    // Port D pin of the CROSSING button.
+};
+
+// Pin map of each crossing, in pelican.c.
+extern const struct CrossingPins CrossingPins[CROSSINGS];
+
 // --------------------------
 // GPIO Outputs
 // --------------------------
 
-// Pin positions on Port E.
+// GPIO access, for the signals, the button and the debug LEDs.
+//   0: through the peripheral bridge (PTB, PTD, PTE).
+//   1: through the single-cycle IOPORT of the core (FPTB, FPTD, FPTE): the
+//      same registers, in one clock instead of a bus access. Only the core
+//      can use the IOPORT, not the DMA.
+#ifndef GPIO_FAST
+#define GPIO_FAST (1)
+#endif
+
+#if GPIO_FAST
+#define GPIO_B FPTB
+#define GPIO_D FPTD
+#define GPIO_E FPTE
+#else
+#define GPIO_B PTB
+#define GPIO_D PTD
+#define GPIO_E PTE
+#endif
+
+// Pin positions on Port E of crossing 0.
 #define RED_POS (3)
 #define AMB_POS (4)
 #define GRE_POS (5)
@@ -27,26 +71,173 @@ extern void PelicanConfig(void);
 // Names for the 6 signals.
 enum PelicanSignal {RED_S, AMBER_S, GREEN_S, DONTWALK_S, WALK_S, WAIT_S};
 
+// SignalSet(), SignalReset() and SignalWrite() only change a shadow of the
+// outputs of a crossing. SignalCommit() writes the shadow to port E in one
+// write, so the lights of a frame all change together. The functions take
+// the index of the crossing, 0 to CROSSINGS - 1.
+
 // Set a signal.
-extern void SignalSet(enum PelicanSignal ps);
+extern void SignalSet(int n, enum PelicanSignal ps);
 
 // Clear a signal.
-extern void SignalReset(enum PelicanSignal ps);
+extern void SignalReset(int n, enum PelicanSignal ps);
+
+// Set the signals whose bits are in the mask and clear the others.
+//   Param: crossing, mask with bit 'ps' for each signal to turn on
+extern void SignalWrite(int n, unsigned mask);
+
+// Write the shadow to the outputs.
+extern void SignalCommit(int n);
+
+// Clear all the signals of a crossing and its shadow now, with one write,
+// without waiting for SignalCommit(). May be called from interrupts.
+extern void SignalResetAll(int n);
+
+// Safe state on a failure: as SignalResetAll() and, if any signal was on,
+// record the time since the failure was detected in SafeLatency (sched.h).
+//   Param: crossing, SysTickNow() at the detection
+extern void SignalSafe(int n, uint32_t detected);
+
+// Port E pins of the signals of each crossing, from CrossingPins.
+extern uint32_t SignalPins[CROSSINGS];
+
+// Port E pins of the signals that are on in the shadow of each crossing.
+extern volatile uint32_t SignalShadow[CROSSINGS];
+
+// Time of an interrupt handler, in core clocks, from its first statement to
+// its last, with the two reads of SysTick->VAL that time it.
+struct IsrCycles {
+    uint32_t last; // Last call.
+    uint32_t max;  // Longest call.
+};
+
+// Time of the output paths of crossing 0, in core clocks, measured by
+// Init_GPIO_Led() for the GPIO_FAST setting of the build, and of the
+// interrupt handlers, measured at each call. The ADC window interrupt's path
+// to the safe state is timed in SafeLatency.
+struct SignalCycles {
+    uint32_t resetAll;      // SignalResetAll().
+    uint32_t commit;        // SignalCommit().
+    struct IsrCycles portd; // PORTD_IRQHandler().
+    struct IsrCycles adc;   // ADC0_IRQHandler(), with ADC_SAMPLING_TIMER or
+                            // ADC_SAMPLING_WINDOW.
+};
+
+extern volatile struct SignalCycles SignalCycles;
 
 // -----------------------------------
 // Measurement
 // -----------------------------------
 
-// Freedom KL25Z ADC Channel.
+// Freedom KL25Z ADC Channel of crossing 0.
 #define ADC_CHANNEL (8) // On port B.
-#define VREF (3.3) // Reference voltage.
+#define VREF_MV (3300) // Reference voltage, in mV.
 #define ADCRANGE (0x0fff) // Maximum for a 12 bit conversion.
 
 #define ADCPOS (0) // Pin number on port B.
 
-//  Uses ADC to read the voltage on the prob point.
-//     Returns raw value from ADC
-extern unsigned Measure(void);
+// ADC profiles, each with its own clock, sample time and hardware average.
+// The ADC is calibrated for each profile when it is selected.
+//   ADC_PROFILE_FAST: average of 4 short samples.
+//   ADC_PROFILE_BALANCED: average of 16 short samples.
+//   ADC_PROFILE_LOWNOISE: average of 32 long, low power samples.
+enum ADCProfile {ADC_PROFILE_FAST, ADC_PROFILE_BALANCED, ADC_PROFILE_LOWNOISE};
+
+#define ADC_PROFILES (3) // Number of profiles.
+
+#ifndef ADC_PROFILE
+#define ADC_PROFILE ADC_PROFILE_BALANCED // Profile selected by Init_ADC().
+#endif
+
+// Select, calibrate and time an ADC profile. Conversions must not be running.
+//   Param: profile
+//   Return: 0 if the calibration completed, 1 if it failed
+extern int ADCSetProfile(enum ADCProfile profile);
+
+// Measured time of one conversion in each profile, in core clocks. Filled
+// for all the profiles by Init_ADC(), and again for the profile in use by
+// each ClockSetProfile().
+extern volatile uint32_t ADCProfileCycles[ADC_PROFILES];
+
+// Sampling modes.
+//   ADC_SAMPLING_SOFTWARE: Measure() starts a conversion and waits for it.
+//   ADC_SAMPLING_DMA: the ADC converts continuously and DMA channel 0 copies
+//     each result into a ring buffer; Measure() never waits.
+//   ADC_SAMPLING_TIMER: PIT channel 0 triggers a conversion every
+//     1 / ADC_TRIGGER_HZ seconds, or every conversion time and a quarter if
+//     the profile is slower at the clock in use, and the conversion complete
+//     interrupt adds the result to an accumulator; Measure() never waits.
+//   ADC_SAMPLING_WINDOW: as software, but while the STM checks a state the
+//     ADC converts continuously against a compare window and interrupts only
+//     on a result outside it.
+#define ADC_SAMPLING_SOFTWARE (0)
+#define ADC_SAMPLING_DMA (1)
+#define ADC_SAMPLING_TIMER (2)
+#define ADC_SAMPLING_WINDOW (3)
+
+#ifndef ADC_SAMPLING
+#define ADC_SAMPLING ADC_SAMPLING_SOFTWARE
+#endif
+
+#define ADC_RING_SIZE (64) // Samples in the DMA ring; a power of 2.
+#define ADC_RING_DMOD (4) // DMA modulo for the ring: 4 is 128 bytes.
+#define ADC_RING_AVERAGE (32) // Samples averaged by Measure() in DMA mode.
+#define ADC_DMA_SOURCE (40) // DMAMUX source number of ADC0.
+#define ADC_TRIGGER_HZ (1000) // Highest conversion rate in timer mode.
+#define ADC_PIT_TRGSEL (4) // SIM_SOPT7 trigger select for PIT channel 0.
+
+// Timing of the triggered conversions, in bus clocks from the PIT trigger to
+// the conversion complete interrupt. The spread between min and max is the
+// jitter of the sample timestamps seen by software; the samples themselves
+// are taken at the trigger.
+struct ADCTriggerStats {
+    uint32_t count;      // Conversions completed.
+    uint32_t minLatency; // Shortest trigger to interrupt time.
+    uint32_t maxLatency; // Longest trigger to interrupt time.
+    uint32_t sumLatency; // For the mean; wraps after about 10^7 conversions.
+};
+
+// Statistics, updated by ADC0_IRQHandler (timer mode only).
+extern volatile struct ADCTriggerStats ADCStats;
+
+// Clear the statistics (timer mode only).
+extern void ADCStatsReset(void);
+
+// Load the compare window and start continuous conversions (window mode
+// only). A result outside [low, high] interrupts: the interrupt stops the
+// conversions, posts a SCHED_EVENT_WINDOW to ADCQueue and, if 'safe' is
+// set, turns all the signals off.
+//   Param: lowest and highest raw values in the window, safe state on trip
+extern void ADCWindowSet(unsigned low, unsigned high, int safe);
+
+// Stop the window conversions (window mode only).
+extern void ADCWindowOff(void);
+
+// The 'safe' parameter of the window.
+extern volatile int ADCWindowSafe;
+
+#define ADC_QUEUE (4) // ADC events kept until taken; a power of 2.
+
+// Events of the ADC interrupts, taken by the STM (window mode only). A
+// SCHED_EVENT_WINDOW carries the result outside the window as its data.
+extern struct SchedQueue ADCQueue;
+
+//  Uses ADC to read the voltage on the prob point of a crossing.
+//     Param: crossing (0 in the modes other than software)
+//     Returns raw value from ADC (the average of the latest ADC_RING_AVERAGE
+//     samples in DMA mode, of the samples since the last call in timer mode)
+extern unsigned Measure(int n);
+
+// Copy the latest samples from the DMA ring, oldest first (DMA mode only).
+//   Param: buffer for the samples, number of samples wanted (at most
+//     ADC_RING_SIZE / 2, so that the DMA does not overwrite them while copied)
+//   Return: number of samples copied, fewer until the ring has filled
+extern unsigned MeasureLatest(uint16_t *samples, unsigned n);
+
+// Average of the latest samples from the DMA ring (DMA mode only).
+//   Param: number of samples, as for MeasureLatest()
+//   Return: raw average, 0 if no sample is available yet
+extern unsigned MeasureAverage(unsigned n);
 
 // --------------------------
 // Button test
@@ -54,21 +245,137 @@ extern unsigned Measure(void);
 
 #define BUTTON_DELAY (10) // Delay in SysTick cycle (ms).
 
-// Switch is on port D for interrupt support.
+// Switch is on port D for interrupt support; the pin of crossing 0.
 #define BUTTON_POS (6)
 
-// Tests whether the button is pressed.
-//   Test the button. If set, then clear the variable set by the interrupt.
-//   Return: Button status
+#define BUTTON_QUEUE (8) // Presses kept until taken; a power of 2.
+
+// Each debounced press is posted by the interrupt to the ButtonQueue of its
+// crossing, as a SCHED_EVENT_BUTTON with the index of the crossing as its
+// data and its StampNow() time. Presses lost because the queue was full are
+// counted in the 'overflows' of the queue.
+extern struct SchedQueue ButtonQueue[CROSSINGS];
+
+// Takes the oldest press of a crossing from its queue.
+//   Param: crossing
+//   Return: 1 if a press was taken, 0 if the queue was empty
+extern int ButtonTestReset(int n);
 
-extern int ButtonTestReset(void);
+// Discards all the queued presses of a crossing.
+extern void ButtonClear(int n);
+
+// StampNow() at the last press taken by ButtonTestReset(), per crossing.
+extern volatile uint32_t ButtonTime[CROSSINGS];
+
+// -----------------------------------
+// Time stamps
+// -----------------------------------
+
+// TPM0 counts from OSCERCLK, the 8 MHz crystal, divided by 8, so the stamps
+// keep the same rate in every clock profile. Its overflow interrupt extends
+// the 16 bit counter to 32 bits.
+#define STAMP_HZ (1000000) // Rate of StampNow().
+#define STAMP_TPM_PS (3) // TPM0 prescaler: divide by 2^3.
+
+// Time since Init_Stamp() in us. Wraps after 2^32 us (71 minutes), so use
+// differences. May be called from interrupts.
+extern uint32_t StampNow(void);
+
+// -----------------------------------
+// Clock
+// -----------------------------------
+
+// Clock profiles, switched at run time by ClockSetProfile().
+//   CLOCK_RUN: PEE from the 8 MHz crystal, core 48 MHz, bus 24 MHz. This is
+//     CLOCK_SETUP 1 of system_MKL25Z4.c, set by SystemInit() at reset.
+//   CLOCK_FEI: FLL on the slow internal reference, core 41.94 MHz, bus
+//     13.98 MHz (CLOCK_SETUP 0).
+//   CLOCK_BLPE: the crystal alone, core and bus 8 MHz (CLOCK_SETUP 2).
+//   CLOCK_VLPR: the 4 MHz internal reference alone (BLPI), core 4 MHz, bus
+//     0.8 MHz, with the core in very low power run.
+enum ClockProfile {CLOCK_RUN, CLOCK_FEI, CLOCK_BLPE, CLOCK_VLPR};
+
+#define CLOCK_PROFILES (4) // Number of profiles.
+
+// Profile of the states that the STM may spend a long time in (GREENON);
+// CLOCK_RUN to never switch.
+#ifndef CLOCK_IDLE
+#define CLOCK_IDLE CLOCK_VLPR
+#endif
+
+// Switch to a clock profile, through FBE (the crystal, FLL and PLL bypassed),
+// and recompute SystemCoreClock. SysTick is reloaded for a 1 ms tick, so the
+// tick in progress restarts, and the ADC is given the clock dividers of its
+// profile for the new bus clock and calibrated again. Conversions of the
+// sampling mode are stopped for the switch and restarted. Returns at once if
+// the profile is already in use.
+//   Param: profile
+//   Return: 0 if the ADC calibration completed, 1 if it failed
+extern int ClockSetProfile(enum ClockProfile profile);
+
+// Profile in use.
+extern volatile enum ClockProfile ClockCurrent;
+
+// Switches and the time spent in each profile.
+struct ClockStats {
+    uint32_t switches;    // Calls that changed the profile.
+    uint32_t calFailures; // Of those, the ADC calibrations that failed.
+    uint32_t ticks[CLOCK_PROFILES]; // SysTicks (ms) spent in each profile.
+};
+
+// Statistics, updated by ClockSetProfile() and the SysTick interrupt.
+extern volatile struct ClockStats ClockStats;
 
 // -----------------------------------
 // SysTick
 // -----------------------------------
 
+// Idle modes for the wait at the end of each frame.
+//   IDLE_SPIN: poll the counter.
+//   IDLE_WFI: sleep (WFI) until the next interrupt, which is at most one
+//     SysTick away. In VLPR the core enters VLPW instead of WAIT.
+#define IDLE_SPIN (0)
+#define IDLE_WFI (1)
+
+#ifndef IDLE_MODE
+#define IDLE_MODE IDLE_WFI
+#endif
+
 // Wait for the SysTick counter to expire and then reset the SysTick counter.
 //   Param Number of ticks to set counter for
 extern void WaitSysTickCounter(int ticks);
 
+// Ticks since start-up, incremented by the SysTick interrupt.
+extern volatile uint32_t SysTickTicks;
+
+// Time since start-up in core clocks, from SysTickTicks and the SysTick
+// counter. Wraps after 2^32 clocks (89 s at 48 MHz), so use differences.
+// The clocks are those of the profile in use at the time, so a difference
+// across a clock switch is a count of clocks, not a time.
+extern uint32_t SysTickNow(void);
+
+// Split of each frame between running the STM and waiting, in core clocks.
+// The totals are kept per clock profile, in which the clocks have the same
+// length: the CPU load in a profile is totalActive / (totalActive +
+// totalAsleep), and the time is the clocks over its core clock.
+struct IdleStats {
+    uint32_t frames;    // Frames completed.
+    uint32_t active;    // Active time of the last frame.
+    uint32_t asleep;    // Waiting time of the last frame.
+    uint32_t maxActive; // Longest active time of any frame.
+    uint32_t wakeups;   // Interrupts that ended a sleep, over all frames.
+    uint64_t totalActive[CLOCK_PROFILES]; // Active time of all the frames.
+    uint64_t totalAsleep[CLOCK_PROFILES]; // Waiting time of all the frames.
+};
+
+// Statistics, updated by WaitSysTickCounter().
+extern volatile struct IdleStats IdleStats;
+
+// Clear the idle statistics, to start a period of measurement.
+extern void IdleStatsReset(void);
+
+// Leave the current frame out of the idle statistics, for work between
+// frames that is not part of one, such as a flash write.
+extern void IdleStatsSkip(void);
+
 #endif
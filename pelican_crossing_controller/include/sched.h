@@ -0,0 +1,145 @@
+#ifndef __SCHED_H
+#define __SCHED_H
+
+// -----------------------------------
+// Configuration
+// -----------------------------------
+
+// Main loop.
+//   0: cyclic executive, one STM frame per WaitSysTickCounter().
+//   1: event driven, the main loop sleeps in SchedWait() and runs on timer
+//      and interrupt events.
+#ifndef SCHEDULER
+#define SCHEDULER (0)
+#endif
+
+#define SCHED_WHEEL (32) // Timer wheel slots, one per tick; a power of 2.
+
+// Event types.
+#define SCHED_EVENT_FRAME (1)  // STM frame timer.
+#define SCHED_EVENT_BUTTON (2) // CROSSING button press.
+#define SCHED_EVENT_WINDOW (3) // ADC result outside the compare window.
+
+#define SCHED_TIMER_QUEUE (8) // Timer events kept until taken; a power of 2.
+
+// -----------------------------------
+// Timers
+// -----------------------------------
+
+// A software timer. Owned by the caller and linked into the wheel while it
+// runs; each expiry queues an 'event' in SchedTimerQueue.
+struct SchedTimer {
+    struct SchedTimer *next;
+    uint32_t expiry; // Tick at which the timer fires.
+    uint32_t period; // Ticks between firings, 0 for a one-shot timer.
+    unsigned event;  // Type of the event posted when the timer fires.
+    int running;
+};
+
+// Start a timer, or restart it if running.
+//   Param: timer, ticks to the first firing (at least 1), ticks between
+//     firings (0 for one-shot), type of the event to post
+extern void SchedTimerStart(struct SchedTimer *t, uint32_t delay,
+        uint32_t period, unsigned event);
+
+// Stop a timer. Has no effect if it is not running.
+extern void SchedTimerStop(struct SchedTimer *t);
+
+// Advance the wheel by one tick and fire the timers that are due. Called
+// from SysTick_Handler.
+extern void SchedTick(void);
+
+// -----------------------------------
+// Event queues
+// -----------------------------------
+
+// An event posted by an interrupt.
+struct SchedEvent {
+    uint16_t type;  // SCHED_EVENT_...
+    uint16_t data;  // Depends on the type.
+    uint32_t stamp; // StampNow() when posted.
+};
+
+// A ring of events with a single producer, one interrupt, and a single
+// consumer, the main loop. Only the producer writes 'head' and only the
+// consumer 'tail'. Both count up, and their difference is the number of
+// events queued, so neither masks the other. Each index is one aligned word
+// with one writer, so no LDREX/STREX (which the M0+ lacks) is needed.
+// Interrupts of one priority cannot preempt each other, so they may share a
+// queue; interrupts of different priorities need one queue each.
+struct SchedQueue {
+    volatile struct SchedEvent *ring;
+    unsigned size;               // Slots in the ring; a power of 2.
+    volatile unsigned head;      // Events posted; written by the producer.
+    volatile unsigned tail;      // Events taken; written by the consumer.
+    unsigned seen;               // Events reported by SchedQueuePeek().
+    volatile uint32_t overflows; // Events dropped as the ring was full.
+    volatile unsigned peak;      // Most events queued at once.
+    struct SchedQueue *watch;    // Next queue watched by SchedWait().
+};
+
+// Timer events, posted by SchedTick() and taken by SchedWait().
+extern struct SchedQueue SchedTimerQueue;
+
+// Queue an event (producer only). A full ring drops the event and counts it
+// in 'overflows'.
+//   Param: queue, type, data and time stamp of the event
+//   Return: 1 if queued, 0 if dropped
+extern int SchedQueuePost(struct SchedQueue *q, unsigned type, unsigned data,
+        uint32_t stamp);
+
+// Take the oldest event (consumer only).
+//   Param: queue, event to fill
+//   Return: 1 if an event was taken, 0 if the queue was empty
+extern int SchedQueueGet(struct SchedQueue *q, struct SchedEvent *e);
+
+// Copy the oldest event not yet reported by this function, and leave it
+// queued (consumer only).
+//   Param: queue, event to fill
+//   Return: 1 if an event was copied, 0 if there was none
+extern int SchedQueuePeek(struct SchedQueue *q, struct SchedEvent *e);
+
+// Discard all the queued events (consumer only).
+extern void SchedQueueFlush(struct SchedQueue *q);
+
+// Have SchedWait() report the new events of a queue that is taken from
+// elsewhere in the main loop.
+extern void SchedWatch(struct SchedQueue *q);
+
+// Sleep until an event is queued. New events of the watched queues are
+// reported first, and stay queued; timer events are taken.
+//   Param: event to fill
+//   Return: the type of the event
+extern unsigned SchedWait(struct SchedEvent *e);
+
+// -----------------------------------
+// Latency
+// -----------------------------------
+
+// Time from an interrupt to the output it caused.
+struct SchedLatency {
+    uint32_t count;
+    uint32_t last;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum; // Mean is sum / count.
+};
+
+// Button press to WAIT output latency, in us, from the StampNow() of the
+// press to the SignalCommit() that turns WAIT on.
+extern volatile struct SchedLatency ButtonLatency;
+
+// Failure detection to all signals off latency, in core clocks.
+extern volatile struct SchedLatency SafeLatency;
+
+// Record a latency that ends now.
+//   Param: statistics, SysTickNow() at the start
+extern void SchedLatencyRecord(volatile struct SchedLatency *l,
+        uint32_t start);
+
+// Record a latency.
+//   Param: statistics, latency
+extern void SchedLatencyAdd(volatile struct SchedLatency *l,
+        uint32_t latency);
+
+#endif
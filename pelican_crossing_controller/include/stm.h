@@ -0,0 +1,234 @@
+#ifndef __STM_H
+#define __STM_H
+
+#include "pelican.h"
+
+// -----------------------------------
+// States
+// -----------------------------------
+
+// --- Names of the states --- //
+#define REDINIT 0 // RED init
+#define AMBERINIT 1 // AMBER init
+#define AMBERFAILUREINIT 2 // AMBER failure init
+#define GREENINIT 3 // GREEN init
+#define DONTWALKINIT 4 // DONTWALK init
+#define WALKINIT 5 // WALK init
+#define WAITINIT 6 // WAIT init
+#define REDANDDONTWALK 7 // RED and DONTWALK
+#define WAITFLASHINGON 8 // WAIT flashing on
+#define WAITFLASHINGOFF 9 // WAIT flashing off
+#define GREENON 10 // GREEN on
+#define WAITON 11 // WAIT on
+#define AMBERON 12 // AMBER on
+#define AMBERFAILURE 13 // AMBER failure
+#define REDON 14 // RED on
+#define WALKON 15 // WALK on
+#define DONTWALKON 16 // DONTWALK on
+#define AMBERANDREDON 17 // AMBER and RED on
+#define AMBERFAILUREANDREDON 18 //AMBER failure and RED on
+
+#define NUMSTATES (19) // Number of rows in the transition table.
+
+// --- Timing delays in seconds --- //
+#define T1 10
+#define T2 10
+#define T3 25
+#define T4 15
+#define T5 5
+#define T6 30
+#define T7 3
+
+#define HIGHTHRESHOLD (700) // Threshold sensed voltage, in mV.
+#define LOWTHRESHOLD (700)  // Threshold sensed voltage, in mV.
+#define TOLERANCE (5) // Allowed error on the expected reading, in percent.
+
+// -----------------------------------
+// Probe sampler
+// -----------------------------------
+
+// Filter over the window of samples.
+//   SAMPLER_MEAN: running sum, updated in O(1) per sample.
+//   SAMPLER_MEDIAN: median, from a sorted copy of the window updated in
+//     O(window) per sample; rejects spikes of less than half the window.
+#define SAMPLER_MEAN (0)
+#define SAMPLER_MEDIAN (1)
+
+#ifndef SAMPLER_FILTER
+#define SAMPLER_FILTER SAMPLER_MEAN
+#endif
+
+#define SAMPLER_MAX (16) // Largest window, in samples; a power of 2.
+
+// Probe readings are integers: the filtered ADC samples in units of
+// 1/PROBE_SCALE of a count, so that the mean of any power of 2 window is a
+// shift. Nothing on the measurement path uses float, which the Cortex-M0+
+// can only do in software.
+#define PROBE_SCALE (SAMPLER_MAX)
+#define MV_TO_PROBE(mv) ((mv) * ADCRANGE * PROBE_SCALE / VREF_MV)
+
+// ---- Debugging only ------------
+#define RED_LED_POS (18) // On port B.
+#define GREEN_LED_POS (19)  // On port B.
+// ---- End debugging only ------------
+
+// -----------------------------------
+// Transition table
+// -----------------------------------
+
+// Bit for a signal in an output mask.
+#define SIG(ps) (1U << (ps))
+
+// Failure check made in a state.
+//   CHECK_NONE: no measurement.
+//   CHECK_CALIBRATE: store the measured voltage of the lit lamp.
+//   CHECK_RED: out of window is a RED or DONTWALK failure.
+//   CHECK_AMBER: out of window is an AMBER failure, use 'amberAlt' instead,
+//     if the current gained or lost is that of AMBER; otherwise it is taken
+//     as a failure of the other lamps, as for CHECK_RED.
+enum StmCheck {CHECK_NONE, CHECK_CALIBRATE, CHECK_RED, CHECK_AMBER};
+
+// Button behaviour of a state.
+//   BUTTON_IGNORE: presses are kept for a later state.
+//   BUTTON_INIT: at exit, once calibrated, a press starts normal operation.
+//   BUTTON_REQUEST: a press leaves the state at once.
+//   BUTTON_CLEAR: presses are discarded at exit.
+enum StmButton {BUTTON_IGNORE, BUTTON_INIT, BUTTON_REQUEST, BUTTON_CLEAR};
+
+// One row per state.
+struct StmRow {
+    uint8_t outputs;  // Mask of the signals that are on.
+    uint8_t seconds;  // Time in the state, 0 if only left by the button.
+    uint8_t next;     // State entered at exit.
+    uint8_t amberAlt; // State used instead once AMBER has failed.
+    uint8_t check;    // enum StmCheck.
+    uint8_t lamp;     // Index in calibrated[] for CHECK_CALIBRATE.
+    uint8_t button;   // enum StmButton.
+    uint8_t window;   // Samples filtered, a power of 2 up to SAMPLER_MAX.
+    uint8_t rate;     // Frames between samples.
+    uint8_t clock;    // enum ClockProfile to run the state in.
+};
+
+// The table is const, in flash. A host tool that changes the timings at run
+// time builds with STM_TABLE_CONST defined empty, which puts it in RAM.
+#ifndef STM_TABLE_CONST
+#define STM_TABLE_CONST const
+#endif
+
+extern STM_TABLE_CONST struct StmRow StmTable[NUMSTATES];
+
+// -----------------------------------
+// Frame timing
+// -----------------------------------
+
+// Time every STM frame (1) or not (0).
+#ifndef STM_STATS
+#define STM_STATS (1)
+#endif
+
+#define STM_HIST_BINS (24) // Bin i counts frames of 2^i to 2^(i+1)-1 clocks.
+
+// Execution time of the frames run in one state, in core clocks.
+struct StmStats {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum; // Mean is sum / count.
+    uint32_t hist[STM_HIST_BINS];
+};
+
+// Statistics for each state, indexed by the state the frame started in,
+// over the frames of all the crossings.
+extern volatile struct StmStats StmStats[NUMSTATES];
+
+// Statistics of whole frames: the STM of every crossing, from the start of
+// the first to the end of the last.
+extern volatile struct StmStats StmFrameStats;
+
+// Clear the statistics.
+extern void StmStatsReset(void);
+
+// -----------------------------------
+// Crossings
+// -----------------------------------
+
+// Probe readings accepted in a state, scaled as the readings. Built from
+// 'calibrated' when the initiation sequence ends and read-only afterwards.
+struct StmLimits {
+    unsigned low;
+    unsigned high;
+};
+
+// Window of probe samples of the current state (see stm.c).
+struct StmSampler {
+    uint16_t samples[SAMPLER_MAX]; // Raw values, oldest at 'head'.
+#if SAMPLER_FILTER == SAMPLER_MEDIAN
+    uint16_t sorted[SAMPLER_MAX];  // Raw values in ascending order.
+#endif
+    int state;      // State the window belongs to.
+    int lit;        // State whose lights went on before its first frame.
+    unsigned head;  // Next slot of the ring.
+    unsigned count; // Samples in the window.
+    unsigned sum;   // Sum of the samples in the window.
+    unsigned shift; // log2(PROBE_SCALE / samples in the last reading).
+    unsigned wait;  // Frames to the next sample, counting this one.
+};
+
+// Everything the STM keeps for one crossing. Every crossing runs StmTable on
+// its own context, and its I/O goes to the pins of CrossingPins[index].
+struct Crossing {
+    int index;              // Crossing number, for the I/O functions.
+    volatile int state;     // Current state.
+    int cycleCounter;       // Frames spent in the state.
+    int redFailure;         // RED or DONTWALK has failed.
+    int amberFailure;       // AMBER has failed.
+    int initCounter;        // Passes through the initiation sequence, from 1.
+    unsigned measuredProbe; // Last reading, scaled.
+    unsigned calibrated[6]; // Reading of each lamp, indexed by PelicanSignal.
+    struct StmLimits limits[NUMSTATES];
+    struct StmSampler sampler;
+#if ADC_SAMPLING == ADC_SAMPLING_WINDOW
+    int windowState;  // State of the window in the ADC compare registers.
+    int windowFrames; // Frames since that state was entered.
+#endif
+};
+
+// The crossings driven by the board.
+extern struct Crossing Crossings[CROSSINGS];
+
+// Put a crossing in REDINIT, uncalibrated, with no failure.
+//   Param: context, crossing number
+extern void CrossingInit(struct Crossing *c, int index);
+
+// -----------------------------------
+// Execution
+// -----------------------------------
+
+// Build the limits of a crossing from its calibrated readings.
+extern void StmLimitsBuild(struct Crossing *c);
+
+// Run one frame of the STM of a crossing, changing its state for the next
+// frame. The clock is not switched: see executeFrame().
+//   Param: crossing
+extern void executeSTM(struct Crossing *c);
+
+// Run one frame of every crossing, one after the other, then switch to the
+// fastest clock profile that the policy gives for their next states.
+//   Param: crossings, number of crossings
+extern void executeFrame(struct Crossing *crossings, int n);
+
+// Clock policy, asked at every frame for the clock profile of the next state.
+// The default, StmClockRow(), gives the 'clock' of the row, so that GREENON,
+// which may last for as long as nobody presses the button, runs at
+// CLOCK_IDLE. Set to 0 to keep the clock as it is.
+extern enum ClockProfile (*StmClockPolicy)(int state);
+
+// The 'clock' of the row of a state.
+extern enum ClockProfile StmClockRow(int state);
+
+// Handle a button press between frames. In a state that the button leaves at
+// once, changes to the next state and turns its lights on now.
+//   Param: crossing of the press
+extern void executeButton(struct Crossing *c);
+
+#endif
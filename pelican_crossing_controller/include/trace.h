@@ -0,0 +1,113 @@
+#ifndef __TRACE_H
+#define __TRACE_H
+
+// -----------------------------------
+// Configuration
+// -----------------------------------
+
+// Trace of the STM.
+//   0: off, the trace calls compile to nothing.
+//   1: records are kept in a ring in RAM and sent over UART0, the OpenSDA
+//      virtual COM port, by DMA channel 1.
+#ifndef TRACE
+#define TRACE (1)
+#endif
+
+// Record mode, for host/replay.c. Needs TRACE and ADC_SAMPLING_SOFTWARE.
+//   0: the trace holds the records of the STM only.
+//   1: every input the firmware reads is also recorded: each ADC
+//      conversion, each press when the main loop first sees it, and the
+//      SysTick count at each frame.
+#ifndef TRACE_INPUTS
+#define TRACE_INPUTS (0)
+#endif
+
+#define TRACE_RING (1024)   // Bytes in the ring; a power of 2, 16 to 1024.
+#define TRACE_RING_SMOD (7) // DMA source modulo: 16 << (SMOD - 1) bytes.
+#define TRACE_BAUD (115200) // UART0 rate, 8 data bits, no parity.
+#define TRACE_UART_HZ (8000000) // OSCERCLK, the UART0 clock.
+#define TRACE_DMA_SOURCE (3)    // DMAMUX source of UART0 transmit.
+#define TRACE_SYNC_US (1000000) // Most time between two sync records.
+
+// -----------------------------------
+// Records
+// -----------------------------------
+//
+// Each record is a type byte, the time since the previous record in us, a
+// state byte and a value. The time and the value are unsigned varints:
+// 7 bits a byte, least significant first, the top bit set in every byte but
+// the last. A probe reading, the record of most frames, takes 7 bytes.
+//
+// A sync record, TRACE_SYNC_0 TRACE_SYNC_1 and the StampNow() time in 4
+// bytes, little endian, starts the stream and follows at least every
+// TRACE_SYNC_US. The time of the next record counts from it. A reader that
+// starts in the middle of the stream, or loses its place, looks for it.
+//
+// The records of the STM carry the number of their crossing (stm.h) in the
+// top 4 bits of the type byte, so the records of crossing 0, and those of a
+// board that drives one crossing, have the plain type. Up to 8 crossings, so
+// that no type byte is TRACE_SYNC_0.
+
+#define TRACE_SYNC_0 (0xA5)
+#define TRACE_SYNC_1 (0x5A)
+
+// Record types: the meaning of the state and the value.
+#define TRACE_STATE (1)   // State entered; the state left.
+#define TRACE_PROBE (2)   // State; a new probe reading (measured_probe).
+#define TRACE_BUTTON (3)  // State; us from the press to the STM taking it.
+#define TRACE_FAILURE (4) // State; the failed check (CHECK_RED or AMBER).
+#define TRACE_LOST (5)    // 0; records lost to a full ring before this one.
+#define TRACE_BOOT (9)    // 1 from the cache, 0 calibrated; us from reset.
+
+// Inputs, with TRACE_INPUTS.
+#define TRACE_FRAME (6)   // State at the start; SysTicks since the last frame.
+#define TRACE_ADC (7)     // 0; the result of a conversion.
+#define TRACE_PRESS (8)   // 0; us from the press to the main loop seeing it.
+
+// Type byte of a record of crossing 'n'.
+#define TRACE_CROSSING(n, type) (((n) << 4) | (type))
+#define TRACE_CROSSINGS (8) // Most crossings the type byte can carry.
+
+#if TRACE
+// Set up UART0 and the DMA channel, and queue the first sync record. Needs
+// StampNow().
+extern void TraceInit(void);
+
+// Add a record to the ring, and start the DMA if it is idle. From the main
+// loop only: it is the single producer of the ring, and the DMA interrupt
+// the single consumer. A record that does not fit is counted, and a
+// TRACE_LOST record precedes the next one that does.
+//   Param: record type, state, value
+extern void TraceRecord(unsigned type, unsigned state, uint32_t value);
+
+// Bytes added to the ring and bytes sent. Both count up; the difference is
+// the bytes in the ring.
+extern volatile uint32_t TraceHead;
+extern volatile uint32_t TraceTail;
+
+// Records lost to a full ring since start-up.
+extern volatile uint32_t TraceLost;
+#else
+#define TraceInit() ((void) 0)
+#define TraceRecord(type, state, value) ((void) 0)
+#endif
+
+#if TRACE && TRACE_INPUTS
+// Add a TRACE_FRAME record, at the start of a frame of the STM, and record
+// the presses queued since the last call.
+//   Param: state
+extern void TraceFrame(unsigned state);
+
+// Add a TRACE_PRESS record for each press queued in ButtonQueue[0] since the
+// last call. Called before the main loop takes or discards presses.
+extern void TracePresses(void);
+
+// Add a record of an input.
+#define TraceInput(type, value) TraceRecord((type), 0, (value))
+#else
+#define TraceFrame(state) ((void) 0)
+#define TracePresses() ((void) 0)
+#define TraceInput(type, value) ((void) 0)
+#endif
+
+#endif
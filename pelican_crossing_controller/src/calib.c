@@ -0,0 +1,379 @@
+#include <MKL25Z4.H>
+#include "pelican.h"
+#include "stm.h"
+#include "trace.h"
+#include "calib.h"
+
+/* -------------------------------------
+ * Calibration cache.
+ *
+ * The initiation sequence lights each lamp for a second to measure its
+ * current, so that a reset leaves the crossing out of use for 8 s or more,
+ * until the button is pressed. The readings are kept in the last sector of
+ * flash instead, written with FTFA commands after the initiation, from the
+ * main loop rather than the frame that ends it.
+ *
+ * A reset that finds a record with the right magic and CRC, from the same
+ * chip and configuration, checks every lamp it holds: GREEN and AMBER with
+ * DONTWALK, RED, DONTWALK and WAIT alone, and WALK with RED, so that no
+ * conflicting signal is shown. If each reading is within TOLERANCE of the
+ * sum of the cached values of its lamps, as the STM checks its states, the
+ * crossing starts in REDANDDONTWALK, in 6 * CALIB_SETTLE + 1 SysTicks, and
+ * more in DMA and timer mode, which wait for new conversions once a lamp
+ * has settled. A lamp that has failed or been changed since fails the
+ * check, and the crossing runs the initiation sequence.
+ *
+ * A crossing that started from the cache and then fails a check of the STM
+ * is dropped from it, so that the next reset calibrates it again rather
+ * than trip on the same lamp. Holding the button of a crossing down at
+ * reset also skips its cache, to calibrate it again by hand.
+ *
+ * The KL25Z cannot read its flash while a command erases or programs it, so
+ * the launch of a command runs from RAM, and interrupts, whose vectors and
+ * handlers are in flash, are masked for the write. Every lamp is turned off
+ * meanwhile, so that none is lit without its checks, and lit again after
+ * it. A record that is already in the cache is not written again, so warm
+ * boots do not wear the flash.
+ * -------------------------------------
+ */
+
+// FTFA commands.
+#define FTFA_PGM4 (0x06)   // Program longword.
+#define FTFA_ERSSCR (0x09) // Erase flash sector.
+
+#define FTFA_ERRORS (FTFA_FSTAT_ACCERR_MASK | FTFA_FSTAT_FPVIOL_MASK | \
+        FTFA_FSTAT_MGSTAT0_MASK)
+
+#define CALIB_WORDS (sizeof (struct CalibRecord) / 4)
+
+volatile uint32_t BootTime[CROSSINGS];
+volatile uint8_t BootWarm[CROSSINGS];
+volatile uint8_t CalibFlashStatus = 0;
+
+#if CALIB_CACHE
+uint32_t CalibValid = 0;
+
+// 1 if CalibValid has changed since the last CalibFlush().
+uint8_t CalibChanged = 0;
+#endif
+
+/*----------------------------------------------------------------------------*
+  Records the boot time of a crossing.
+ *----------------------------------------------------------------------------*/
+void CalibBoot(struct Crossing *c, int warm) {
+    uint32_t now = StampNow();
+
+    BootTime[c->index] = now;
+    BootWarm[c->index] = warm;
+    TraceRecord(TRACE_CROSSING(c->index, TRACE_BOOT), warm, now);
+}
+
+#if CALIB_CACHE
+// Lamps lit together for the spot check, in the order of the vehicle
+// signals: each lamp of the record, alone or with one that makes a signal
+// of the STM.
+static const uint8_t CalibSpotLamps[] = {
+    SIG(GREEN_S) | SIG(DONTWALK_S), SIG(AMBER_S) | SIG(DONTWALK_S),
+    SIG(RED_S), SIG(DONTWALK_S), SIG(WAIT_S), SIG(RED_S) | SIG(WALK_S)
+};
+
+/*----------------------------------------------------------------------------*
+  CRC-32 (IEEE 802.3, reflected), bit by bit: the KL25Z has no CRC module,
+  and the record is checked once per reset.
+ *----------------------------------------------------------------------------*/
+uint32_t calibCrc(uint32_t crc, const void *data, unsigned bytes) {
+    const uint8_t *p = data;
+    int bit;
+
+    crc = ~crc;
+    while (bytes--) {
+        crc ^= *p++;
+        for (bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+    }
+
+    return ~crc;
+}
+
+/*----------------------------------------------------------------------------*
+  Signature of the configuration the readings depend on: the pin map and
+  the ADC settings.
+ *----------------------------------------------------------------------------*/
+uint32_t calibConfig(void) {
+    const uint32_t adc[3] = {ADC_PROFILE, ADC_SAMPLING, PROBE_SCALE};
+
+    return calibCrc(calibCrc(0, CrossingPins, sizeof CrossingPins), adc,
+            sizeof adc);
+}
+
+/*----------------------------------------------------------------------------*
+  Copies the record out of flash.
+ *----------------------------------------------------------------------------*/
+void calibRead(struct CalibRecord *r) {
+    uint32_t *w = (uint32_t *) r;
+    unsigned i;
+
+    for (i = 0; i < CALIB_WORDS; i++)
+        w[i] = FLASH_WORD(CALIB_ADDR + 4 * i);
+}
+
+/*----------------------------------------------------------------------------*
+  Fills a record with the readings of the crossings in 'valid'.
+ *----------------------------------------------------------------------------*/
+void calibBuild(struct CalibRecord *r, uint32_t valid) {
+    int n, ps;
+
+    r->magic = CALIB_MAGIC;
+    r->uid[0] = SIM->UIDMH;
+    r->uid[1] = SIM->UIDML;
+    r->uid[2] = SIM->UIDL;
+    r->config = calibConfig();
+    r->valid = valid;
+    for (n = 0; n < CROSSINGS; n++)
+        for (ps = RED_S; ps <= WAIT_S; ps++)
+            r->calibrated[n][ps] = (valid & (1U << n)) ?
+                Crossings[n].calibrated[ps] : 0;
+    r->crc = calibCrc(0, r, CALIB_WORDS * 4 - 4);
+}
+
+/*----------------------------------------------------------------------------*
+  Returns 1 if a record read from flash can be used on this board.
+ *----------------------------------------------------------------------------*/
+int calibValid(const struct CalibRecord *r) {
+    return r->magic == CALIB_MAGIC &&
+        r->crc == calibCrc(0, r, CALIB_WORDS * 4 - 4) &&
+        r->uid[0] == SIM->UIDMH && r->uid[1] == SIM->UIDML &&
+        r->uid[2] == SIM->UIDL && r->config == calibConfig();
+}
+
+/*----------------------------------------------------------------------------*
+  Sleeps for a number of ticks.
+ *----------------------------------------------------------------------------*/
+void calibWait(uint32_t ticks) {
+    uint32_t start = SysTickTicks;
+
+    while (SysTickTicks - start < ticks)
+        __WFI();
+}
+
+/*----------------------------------------------------------------------------*
+  Lights lamps of a crossing, SIG() bits, and returns their reading once
+  settled: the sum of CALIB_SAMPLES samples, on the scale of the STM. Only
+  samples converted after CALIB_SETTLE are used, in every sampling mode.
+ *----------------------------------------------------------------------------*/
+unsigned calibSpot(struct Crossing *c, unsigned lamps) {
+    unsigned sum = 0;
+    int i;
+
+    SignalWrite(c->index, lamps);
+    SignalCommit(c->index);
+    calibWait(CALIB_SETTLE);
+
+#if ADC_SAMPLING == ADC_SAMPLING_DMA
+    // Measure() averages the latest conversions of the ring, which still
+    // holds some from before the lamps had settled: wait for as many new
+    // ones.
+    calibWait(ADC_RING_AVERAGE * ADCProfileCycles[ADC_PROFILE]
+            / (SystemCoreClock / 1000) + 1);
+#elif ADC_SAMPLING == ADC_SAMPLING_TIMER
+    // Measure() averages the conversions since its last call: drop those
+    // from before the lamps had settled.
+    Measure(c->index);
+#endif
+
+    for (i = 0; i < CALIB_SAMPLES; i++) {
+#if ADC_SAMPLING == ADC_SAMPLING_TIMER
+        calibWait(1); // New conversions, triggered at most once a tick.
+#endif
+        sum = sum + Measure(c->index);
+    }
+
+    return sum;
+}
+
+/*----------------------------------------------------------------------------*
+  Checks the cached readings of a crossing against its lamps. Returns 1 if
+  the reading of every step of the spot check is within TOLERANCE of the sum
+  of the cached readings of its lamps.
+ *----------------------------------------------------------------------------*/
+int calibCheck(struct Crossing *c) {
+    unsigned i, reading, expected, margin;
+    uint32_t start = SysTickTicks;
+    int ok = 1, ps;
+
+    // Start on a tick, so that each lamp settles for whole ticks.
+    while (SysTickTicks == start)
+        __WFI();
+
+    for (i = 0; i < sizeof CalibSpotLamps && ok; i++) {
+        expected = 0;
+        for (ps = RED_S; ps <= WAIT_S; ps++)
+            if (CalibSpotLamps[i] & SIG(ps))
+                expected += c->calibrated[ps];
+        margin = expected * TOLERANCE / 100;
+        reading = calibSpot(c, CalibSpotLamps[i]);
+        ok = (reading + margin >= expected) && (reading <= expected + margin);
+    }
+
+    SignalWrite(c->index, 0);
+    SignalCommit(c->index);
+    return ok;
+}
+
+// Launch of the command loaded in FCCOB, and wait for it to complete, as
+// Thumb code: the flash cannot be read until then. The array is initialised
+// data, which the start-up code copies to RAM, so no section of the scatter
+// file is needed. Called with the address of FSTAT.
+uint16_t FlashRunCode[] __attribute__((aligned(4))) = {
+    0x2180, //     movs r1, #0x80   CCIF
+    0x7001, //     strb r1, [r0]    Launch.
+    0x7802, // 1:  ldrb r2, [r0]
+    0x420a, //     tst  r2, r1
+    0xd0fc, //     beq  1b          Until CCIF is set again.
+    0x4770  //     bx   lr
+};
+
+// Runs the code in RAM, in Thumb state. The host tools run their model of
+// the FTFA instead.
+#ifndef FLASH_RUN
+#define FLASH_RUN(fstat) ((void (*)(volatile uint8_t *)) \
+        ((uintptr_t) FlashRunCode | 1))(fstat)
+#endif
+
+/*----------------------------------------------------------------------------*
+  Runs a flash command on an address: an erase, or a program of 'data'.
+  Called with interrupts masked. Returns the error flags of FSTAT, 0 on
+  success.
+ *----------------------------------------------------------------------------*/
+uint8_t flashCommand(uint8_t command, uint32_t addr, uint32_t data) {
+    uint8_t status;
+
+    while (!(FTFA->FSTAT & FTFA_FSTAT_CCIF_MASK))
+        ;
+
+    FTFA->FSTAT = FTFA_FSTAT_ACCERR_MASK | FTFA_FSTAT_FPVIOL_MASK;
+    FTFA->FCCOB0 = command;
+    FTFA->FCCOB1 = (uint8_t) (addr >> 16);
+    FTFA->FCCOB2 = (uint8_t) (addr >> 8);
+    FTFA->FCCOB3 = (uint8_t) addr;
+    FTFA->FCCOB4 = (uint8_t) (data >> 24);
+    FTFA->FCCOB5 = (uint8_t) (data >> 16);
+    FTFA->FCCOB6 = (uint8_t) (data >> 8);
+    FTFA->FCCOB7 = (uint8_t) data;
+
+    FLASH_RUN(&FTFA->FSTAT);
+    status = FTFA->FSTAT;
+
+    CalibFlashStatus = status;
+    return status & FTFA_ERRORS;
+}
+
+/*----------------------------------------------------------------------------*
+  Writes a record to the cache, with interrupts masked and every lamp off.
+  The lamps are then given CALIB_SETTLE ticks before the STM reads them.
+ *----------------------------------------------------------------------------*/
+void calibWrite(const struct CalibRecord *r) {
+    const uint32_t *w = (const uint32_t *) r;
+    uint32_t lit, pins = 0;
+    unsigned i;
+    int n;
+
+    for (n = 0; n < CROSSINGS; n++)
+        pins |= SignalPins[n];
+
+    __disable_irq();
+    lit = GPIO_E->PDOR;
+    GPIO_E->PDOR = lit & ~pins;
+
+    if (flashCommand(FTFA_ERSSCR, CALIB_ADDR, 0) == 0)
+        for (i = 0; i < CALIB_WORDS; i++)
+            if (flashCommand(FTFA_PGM4, CALIB_ADDR + 4 * i, w[i]))
+                break;
+
+    GPIO_E->PDOR = lit;
+    __enable_irq();
+
+    calibWait(CALIB_SETTLE);
+}
+
+/*----------------------------------------------------------------------------*
+  Starts the crossings whose cached calibration passes the spot check.
+ *----------------------------------------------------------------------------*/
+void CalibLoad(struct Crossing *crossings, int n) {
+    struct CalibRecord r;
+    int i, ps;
+
+    calibRead(&r);
+    if (!calibValid(&r))
+        return;
+
+    for (i = 0; i < n; i++) {
+        struct Crossing *c = &crossings[i];
+
+        if (!(r.valid & (1U << i)))
+            continue;
+
+        // Button held down at reset: calibrate again.
+        if (!(GPIO_D->PDIR & MASK(CrossingPins[i].button)))
+            continue;
+
+        for (ps = RED_S; ps <= WAIT_S; ps++)
+            c->calibrated[ps] = r.calibrated[i][ps];
+
+        if (!calibCheck(c)) {
+            CrossingInit(c, i);
+            continue;
+        }
+
+        StmLimitsBuild(c);
+        CalibValid |= 1U << i;
+        c->state = REDANDDONTWALK;
+        TraceRecord(TRACE_CROSSING(i, TRACE_STATE), REDANDDONTWALK, REDINIT);
+        CalibBoot(c, 1);
+    }
+}
+
+/*----------------------------------------------------------------------------*
+  Marks the calibration for the cache at the end of an initiation.
+ *----------------------------------------------------------------------------*/
+void CalibStore(struct Crossing *c) {
+    CalibBoot(c, 0);
+    CalibValid |= 1U << c->index;
+    CalibChanged = 1;
+}
+
+/*----------------------------------------------------------------------------*
+  Drops the calibration of a crossing that started from the cache.
+ *----------------------------------------------------------------------------*/
+void CalibDrop(struct Crossing *c) {
+    uint32_t bit = 1U << c->index;
+
+    if (!BootWarm[c->index] || !(CalibValid & bit))
+        return;
+
+    CalibValid &= ~bit;
+    CalibChanged = 1;
+}
+
+/*----------------------------------------------------------------------------*
+  Writes the marked calibrations, between frames.
+ *----------------------------------------------------------------------------*/
+void CalibFlush(void) {
+    struct CalibRecord r, old;
+    const uint32_t *w = (const uint32_t *) &r;
+    unsigned i;
+
+    if (!CalibChanged)
+        return;
+    CalibChanged = 0;
+
+    calibBuild(&r, CalibValid);
+    calibRead(&old);
+    for (i = 0; i < CALIB_WORDS && w[i] == ((const uint32_t *) &old)[i]; i++)
+        ;
+    if (i < CALIB_WORDS) {
+        calibWrite(&r);
+        IdleStatsSkip();
+    }
+}
+#endif
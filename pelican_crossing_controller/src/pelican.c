@@ -1,5 +1,30 @@
 #include <MKL25Z4.H>
 #include "pelican.h"
+#include "sched.h"
+#include "trace.h"
+
+#if CROSSINGS > 1 && ADC_SAMPLING != ADC_SAMPLING_SOFTWARE
+#error "CROSSINGS > 1 needs ADC_SAMPLING_SOFTWARE, to convert each probe"
+#endif
+
+// -----------------------------------
+// Pin map
+// -----------------------------------
+// Signals on port E, probes on port B and buttons on port D, so that each
+// crossing uses the same ports as the first one.
+const struct CrossingPins CrossingPins[CROSSINGS] = {
+    // PTE3, PTE4, PTE5, PTE21, PTE22, PTE23; PTB0 (ADC0_SE8); PTD6.
+    {{RED_POS, AMB_POS, GRE_POS, DWL_POS, WLK_POS, WAI_POS},
+        ADC_CHANNEL, ADCPOS, BUTTON_POS},
+#if CROSSINGS > 1
+    // PTE20, PTE29, PTE30, PTE0, PTE1, PTE2; PTB1 (ADC0_SE9); PTD7.
+    {{20, 29, 30, 0, 1, 2}, 9, 1, 7},
+#endif
+};
+
+#if CROSSINGS > 2
+#error "CROSSINGS: the pin map has pins for 2 crossings"
+#endif
 
 // -----------------------------------
 // Initialisation routines
@@ -7,19 +32,33 @@
 //   Init_GPIO_Led: LED GPIO o/p
 //   Init_ADC: initialise ADC for current measurement
 //   Init_SysTick: make SysTick tick every ms
+//   Init_Clock: allow the clock profiles
+//   Init_Stamp: start the time stamp counter
 // -----------------------------------
 
-// Initialse Port D BUTTON_POS (pin 6) as an input, with an interrupt.
+// Bus clock, which also clocks the flash, the ADC and the PIT, in Hz.
+uint32_t busClock(void) {
+    return SystemCoreClock / (((SIM->CLKDIV1 & SIM_CLKDIV1_OUTDIV4_MASK)
+            >> SIM_CLKDIV1_OUTDIV4_SHIFT) + 1);
+}
+
+// Initialse the Port D pin of each button as an input, with an interrupt.
 void Init_Button(void) {
+    int n;
+
     SIM->SCGC5 |=  SIM_SCGC5_PORTD_MASK; // Enable clock for port D.
 
-    /* Select GPIO and DISable pull-up resistors and interrupts on falling edges
-     * for pins connected to switches */
-    PORTD->PCR[BUTTON_POS] &= ~PORT_PCR_PS_MASK;
-    PORTD->PCR[BUTTON_POS] |= PORT_PCR_MUX(1) | PORT_PCR_IRQC(0x0a);
+    for (n = 0; n < CROSSINGS; n++) {
+        uint32_t pos = CrossingPins[n].button;
+
+        /* Select GPIO and DISable pull-up resistors and interrupts on falling
+         * edges for pins connected to switches */
+        PORTD->PCR[pos] &= ~PORT_PCR_PS_MASK;
+        PORTD->PCR[pos] |= PORT_PCR_MUX(1) | PORT_PCR_IRQC(0x0a);
 
-    /* Set port D switch bit to inputs. */
-    PTD->PDDR &= ~MASK(BUTTON_POS);
+        /* Set port D switch bit to inputs. */
+        GPIO_D->PDDR &= ~MASK(pos);
+    }
 
     /* Enable Interrupts. */
     NVIC_SetPriority(PORTD_IRQn, 128); // 0, 64, 128 or 192
@@ -28,53 +67,382 @@ void Init_Button(void) {
 }
 
 
+volatile struct SignalCycles SignalCycles;
+
+// Record the time of an interrupt handler from 'start', its first reading of
+// SysTick->VAL. Handlers take far less than a tick.
+void IsrCyclesRecord(volatile struct IsrCycles *c, uint32_t start) {
+    uint32_t end = SysTick->VAL;
+
+    c->last = (start >= end) ? start - end : start + (SysTick->LOAD + 1) - end;
+    if (c->last > c->max)
+        c->max = c->last;
+}
+
 // Initialise GPIO o/p pins on Port E.
 void Init_GPIO_Led(void) {
+    uint32_t start, overhead;
+    int n, ps;
+
     // Enable clock to port E
     SIM->SCGC5 |= SIM_SCGC5_PORTE_MASK;
 
-    // Make PTE pins GPIO.
-    PORTE->PCR[RED_POS] &= ~PORT_PCR_MUX_MASK;
-    PORTE->PCR[RED_POS] |= PORT_PCR_MUX(1);
-    PORTE->PCR[AMB_POS] &= ~PORT_PCR_MUX_MASK;
-    PORTE->PCR[AMB_POS] |= PORT_PCR_MUX(1);
-    PORTE->PCR[GRE_POS] &= ~PORT_PCR_MUX_MASK;
-    PORTE->PCR[GRE_POS] |= PORT_PCR_MUX(1);
-    PORTE->PCR[DWL_POS] &= ~PORT_PCR_MUX_MASK;
-    PORTE->PCR[DWL_POS] |= PORT_PCR_MUX(1);
-    PORTE->PCR[WLK_POS] &= ~PORT_PCR_MUX_MASK;
-    PORTE->PCR[WLK_POS] |= PORT_PCR_MUX(1);
-    PORTE->PCR[WAI_POS] &= ~PORT_PCR_MUX_MASK;
-    PORTE->PCR[WAI_POS] |= PORT_PCR_MUX(1);
-
-    // Set PTE pins to output
-    PTE->PDDR |= MASK(RED_POS)
-        |  MASK(AMB_POS)
-        |  MASK(GRE_POS)
-        |  MASK(DWL_POS)
-        |  MASK(WLK_POS)
-        |  MASK(WAI_POS);
+    // Make the PTE pins of every crossing GPIO.
+    for (n = 0; n < CROSSINGS; n++) {
+        SignalPins[n] = 0;
+
+        for (ps = RED_S; ps <= WAIT_S; ps++) {
+            uint32_t pos = CrossingPins[n].signal[ps];
+
+            PORTE->PCR[pos] &= ~PORT_PCR_MUX_MASK;
+            PORTE->PCR[pos] |= PORT_PCR_MUX(1);
+            SignalPins[n] |= MASK(pos);
+        }
+
+        // Set PTE pins to output
+        GPIO_E->PDDR |= SignalPins[n];
+    }
+
+    // Time the output paths, less the time of the timing itself. SysTick
+    // runs from Init_SysTick().
+    start = SysTickNow();
+    overhead = SysTickNow() - start;
+
+    start = SysTickNow();
+    SignalResetAll(0);
+    SignalCycles.resetAll = SysTickNow() - start - overhead;
+
+    start = SysTickNow();
+    SignalCommit(0);
+    SignalCycles.commit = SysTickNow() - start - overhead;
+}
+
+#if ADC_SAMPLING == ADC_SAMPLING_DMA
+// Ring written by DMA channel 0, aligned to its size for the DMA modulo.
+volatile uint16_t ADCRing[ADC_RING_SIZE]
+    __attribute__((aligned(ADC_RING_SIZE * 2)));
+
+// Number of times the DMA byte count has been reloaded.
+volatile unsigned ADCRingReloads = 0;
+
+#define ADC_DMA_BYTES (0xFFF00) // Byte count per DMA reload, max 0xFFFFF.
+
+// Start continuous conversions with each result copied by DMA channel 0 into
+// ADCRing. The destination wraps on the ring with the DMA modulo, so the CPU
+// is only involved when the byte count runs out.
+void Init_ADC_DMA(void) {
+    // Enable clock to the DMA and its multiplexer.
+    SIM->SCGC6 |= SIM_SCGC6_DMAMUX_MASK;
+    SIM->SCGC7 |= SIM_SCGC7_DMA_MASK;
+
+    DMAMUX0->CHCFG[0] = 0; // Disable while configuring.
+
+    DMA0->DMA[0].SAR = (uint32_t) &ADC0->R[0];
+    DMA0->DMA[0].DAR = (uint32_t) ADCRing;
+    DMA0->DMA[0].DSR_BCR = DMA_DSR_BCR_BCR(ADC_DMA_BYTES);
+
+    // Set DMA_DCR0
+    //   EINT --> interrupt when the byte count is done
+    //   ERQ --> transfer on request from the peripheral
+    //   CS --> one transfer per request
+    //   SSIZE, DSIZE --> 16 bit
+    //   DINC --> increment destination, wrapping on ADC_RING_DMOD
+    DMA0->DMA[0].DCR = DMA_DCR_EINT_MASK | DMA_DCR_ERQ_MASK | DMA_DCR_CS_MASK
+        | DMA_DCR_SSIZE(2) | DMA_DCR_DINC_MASK | DMA_DCR_DSIZE(2)
+        | DMA_DCR_DMOD(ADC_RING_DMOD);
+
+    DMAMUX0->CHCFG[0] = DMAMUX_CHCFG_ENBL_MASK
+        | DMAMUX_CHCFG_SOURCE(ADC_DMA_SOURCE);
+
+    NVIC_SetPriority(DMA0_IRQn, 64);
+    NVIC_ClearPendingIRQ(DMA0_IRQn);
+    NVIC_EnableIRQ(DMA0_IRQn);
+
+    // Request DMA on conversion complete and convert continuously.
+    ADC0->SC2 |= ADC_SC2_DMAEN_MASK;
+    ADC0->SC3 |= ADC_SC3_ADCO_MASK;
+
+    // Start the first conversion.
+    ADC0->SC1[0] = CrossingPins[0].probe;
+}
+
+// Reload the DMA byte count when it runs out.
+void DMA0_IRQHandler(void) {
+    DMA0->DMA[0].DSR_BCR = DMA_DSR_BCR_DONE_MASK; // Clear the done flag.
+    DMA0->DMA[0].DSR_BCR = DMA_DSR_BCR_BCR(ADC_DMA_BYTES);
+    ADCRingReloads++;
+}
+#endif
+
+#if ADC_SAMPLING == ADC_SAMPLING_TIMER
+// Accumulator written by ADC0_IRQHandler and emptied by Measure().
+volatile uint32_t ADCAccSum = 0;
+volatile uint32_t ADCAccCount = 0;
+volatile uint32_t ADCLast = 0;
+
+volatile struct ADCTriggerStats ADCStats;
+
+// Clear the statistics.
+void ADCStatsReset(void) {
+    __disable_irq();
+    ADCStats.count = 0;
+    ADCStats.minLatency = 0xffffffff;
+    ADCStats.maxLatency = 0;
+    ADCStats.sumLatency = 0;
+    __enable_irq();
+}
+
+// PIT period of the triggers, in bus clocks: 1 / ADC_TRIGGER_HZ s, or one
+// conversion of the profile and a quarter more, if that is longer. A trigger
+// that comes during a conversion is lost; the low noise profile, on the
+// asynchronous clock of CLOCK_VLPR, takes more than 1 ms.
+//   Param: ADC profile, timed for the clock in use
+uint32_t adcTriggerPeriod(enum ADCProfile profile) {
+    uint32_t bus = busClock();
+    uint32_t period = bus / ADC_TRIGGER_HZ;
+    // The time of ADCSetProfile(), from core to bus clocks, in kHz so as not
+    // to overflow.
+    uint32_t conversion = ADCProfileCycles[profile] * (bus / 1000)
+        / (SystemCoreClock / 1000);
+
+    conversion = conversion + conversion / 4;
+    return (conversion > period) ? conversion : period;
+}
+
+// Start conversions triggered by PIT channel 0 every adcTriggerPeriod(),
+// each completed by ADC0_IRQHandler.
+void Init_ADC_Timer(void) {
+    ADCStatsReset();
+
+    // Enable clock to the PIT and start its timers.
+    SIM->SCGC6 |= SIM_SCGC6_PIT_MASK;
+    PIT->MCR = 0;
+
+    PIT->CHANNEL[0].TCTRL = 0;
+    // Bus clocks. Init_ADC() has just timed ADC_PROFILE.
+    PIT->CHANNEL[0].LDVAL = adcTriggerPeriod(ADC_PROFILE) - 1;
+
+    // Select PIT channel 0 as the alternative ADC0 trigger.
+    SIM->SOPT7 = SIM_SOPT7_ADC0ALTTRGEN_MASK
+        | SIM_SOPT7_ADC0TRGSEL(ADC_PIT_TRGSEL);
+
+    // Hardware trigger, interrupt on conversion complete.
+    ADC0->SC2 |= ADC_SC2_ADTRG_MASK;
+    ADC0->SC1[0] = ADC_SC1_AIEN_MASK | CrossingPins[0].probe;
+
+    NVIC_SetPriority(ADC0_IRQn, 64);
+    NVIC_ClearPendingIRQ(ADC0_IRQn);
+    NVIC_EnableIRQ(ADC0_IRQn);
+
+    PIT->CHANNEL[0].TCTRL = PIT_TCTRL_TEN_MASK;
+}
+
+// Add each result to the accumulator and time it against the trigger.
+void ADC0_IRQHandler(void) {
+    uint32_t start = SysTick->VAL;
+    // The PIT counts down from LDVAL since the trigger.
+    uint32_t latency = PIT->CHANNEL[0].LDVAL - PIT->CHANNEL[0].CVAL;
+    uint32_t sample = ADC0->R[0]; // Reading this clears the COCO flag.
+
+    ADCLast = sample;
+    ADCAccSum += sample;
+    ADCAccCount++;
+
+    ADCStats.count++;
+    ADCStats.sumLatency += latency;
+    if (latency < ADCStats.minLatency)
+        ADCStats.minLatency = latency;
+    if (latency > ADCStats.maxLatency)
+        ADCStats.maxLatency = latency;
+
+    IsrCyclesRecord(&SignalCycles.adc, start);
+}
+#endif
+
+#if ADC_SAMPLING == ADC_SAMPLING_WINDOW
+volatile int ADCWindowSafe = 0;
+
+volatile struct SchedEvent ADCEvents[ADC_QUEUE];
+struct SchedQueue ADCQueue = {ADCEvents, ADC_QUEUE};
+
+// Stop the window conversions.
+void ADCWindowOff(void) {
+    ADC0->SC1[0] = ADC_SC1_ADCH(0x1f); // ADCH 11111 disables the ADC.
+    ADC0->SC3 &= ~ADC_SC3_ADCO_MASK;
+    ADC0->SC2 &= ~(ADC_SC2_ACFE_MASK | ADC_SC2_ACFGT_MASK | ADC_SC2_ACREN_MASK);
+}
+
+// Load the compare window and start continuous conversions.
+void ADCWindowSet(unsigned low, unsigned high, int safe) {
+    ADCWindowOff();
+    ADCWindowSafe = safe;
+
+    // Set the ADC0_SC2 compare bits
+    //   1 --> ACFE - compare enable
+    //   0 --> ACFGT - with ACREN, true outside the range
+    //   1 --> ACREN - range CV1 to CV2
+    ADC0->CV1 = low;
+    ADC0->CV2 = high;
+    ADC0->SC2 |= ADC_SC2_ACFE_MASK | ADC_SC2_ACREN_MASK;
+
+    // Convert continuously; COCO is only set for a result outside the window.
+    ADC0->SC3 |= ADC_SC3_ADCO_MASK;
+    ADC0->SC1[0] = ADC_SC1_AIEN_MASK | CrossingPins[0].probe;
+}
+
+// A result is outside the window.
+void ADC0_IRQHandler(void) {
+    uint32_t start = SysTick->VAL;
+    uint32_t detected = SysTickNow();
+    uint32_t result = ADC0->R[0]; // Reading this clears the COCO flag.
+
+    if (ADCWindowSafe)
+        SignalSafe(0, detected);
+
+    ADCWindowOff();
+    SchedQueuePost(&ADCQueue, SCHED_EVENT_WINDOW, result, StampNow());
+
+    IsrCyclesRecord(&SignalCycles.adc, start);
+}
+#endif
+
+// Start one conversion of a channel and wait for the result.
+unsigned ADCConvert(unsigned channel) {
+    unsigned res = 0;
+
+    // Write to ADC0_SC1A
+    //   0 --> AIEN Conversion interrupt diabled
+    //   0 --> DIFF single end conversion
+    //   ADCH --> the channel, e.g. 01000 for AD8
+    ADC0->SC1[0] = channel; // Writing to this clears the COCO flag.
+
+    // Test the conversion complete flag, which is 1 when completed.
+    while (!(ADC0->SC1[0] & ADC_SC1_COCO_MASK)); // Empty loop.
+
+    // Read results from ADC0_RA as an unsigned integer.
+    res = ADC0->R[0] ; // Reading this clears the COCO flag.
+    TraceInput(TRACE_ADC, res);
+    return res;
+}
+
+// ADC0_CFG1 (less the clock bits), ADC0_CFG2 and ADC0_SC3 for each profile,
+// and the fastest ADCK it is meant for. All use 12 bit conversions of the bus
+// clock, divided by adcClock() for the clock profile in use.
+const struct {
+    uint8_t cfg1;
+    uint8_t cfg2;
+    uint8_t sc3;
+    uint32_t adck; // Hz.
+} ADCProfiles[ADC_PROFILES] = {
+    // Fast: ADCK 12 MHz (bus / 2 in CLOCK_RUN), short sample, average of 4.
+    {ADC_CFG1_MODE(1), 0,
+        ADC_SC3_AVGE_MASK | ADC_SC3_AVGS(0), 12000000},
+
+    // Balanced: ADCK 6 MHz (bus / 4), short sample, average of 16.
+    {ADC_CFG1_MODE(1), 0,
+        ADC_SC3_AVGE_MASK | ADC_SC3_AVGS(2), 6000000},
+
+    // Low noise: low power, ADCK 6 MHz, longest sample, average of 32.
+    {ADC_CFG1_ADLPC_MASK | ADC_CFG1_ADLSMP_MASK | ADC_CFG1_MODE(1),
+        ADC_CFG2_ADLSTS(0),
+        ADC_SC3_AVGE_MASK | ADC_SC3_AVGS(3), 6000000}
+};
+
+#define ADCK_MIN (1000000) // Slowest ADCK from the bus clock, in Hz.
+
+// Profile selected by the last ADCSetProfile().
+enum ADCProfile adcProfile = ADC_PROFILE;
+
+// ADC0_CFG1 clock bits for a profile: the least division of the bus clock
+// that is no faster than the ADCK of the profile, up to bus / 16. Below
+// ADCK_MIN, the bus clock is too slow and the ADC uses its own asynchronous
+// clock (about 2.4 MHz, or 1.2 MHz in low power).
+//   Param: ADCK of the profile, in Hz
+//   Return: ADICLK and ADIV bits
+uint32_t adcClock(uint32_t adck) {
+    uint32_t bus = busClock();
+    unsigned div = 0;
+
+    if (bus < ADCK_MIN)
+        return ADC_CFG1_ADICLK(3);
+
+    while (div < 4 && (bus >> div) > adck)
+        div++;
+
+    if (div == 4) // Bus / 2, then / 8.
+        return ADC_CFG1_ADICLK(1) | ADC_CFG1_ADIV(3);
+
+    return ADC_CFG1_ADIV(div);
+}
+
+// Measured time of one (averaged) conversion in each profile, in core clocks.
+volatile uint32_t ADCProfileCycles[ADC_PROFILES];
+
+// Run the ADC self-calibration and load the plus and minus side gains.
+//   Return: 0 if the calibration completed, 1 if it failed
+int ADCCalibrate(void) {
+    uint16_t cal;
+
+    // Calibrate with the maximum hardware average, as recommended.
+    ADC0->SC3 = ADC_SC3_CAL_MASK | ADC_SC3_AVGE_MASK | ADC_SC3_AVGS(3);
+
+    while (ADC0->SC3 & ADC_SC3_CAL_MASK); // Empty loop.
+
+    if (ADC0->SC3 & ADC_SC3_CALF_MASK)
+        return 1;
+
+    cal = ADC0->CLP0 + ADC0->CLP1 + ADC0->CLP2 + ADC0->CLP3 + ADC0->CLP4
+        + ADC0->CLPS;
+    ADC0->PG = (cal >> 1) | 0x8000;
+
+    cal = ADC0->CLM0 + ADC0->CLM1 + ADC0->CLM2 + ADC0->CLM3 + ADC0->CLM4
+        + ADC0->CLMS;
+    ADC0->MG = (cal >> 1) | 0x8000;
+
+    return 0;
+}
+
+// Select an ADC profile, calibrate it and time one conversion. Conversions
+// must not be running (call before Init_ADC_DMA() or Init_ADC_Timer()).
+//   Return: 0 if the calibration completed, 1 if it failed
+int ADCSetProfile(enum ADCProfile profile) {
+    uint32_t start, end;
+    int r;
+
+    adcProfile = profile;
+    ADC0->CFG1 = ADCProfiles[profile].cfg1
+        | adcClock(ADCProfiles[profile].adck);
+    ADC0->CFG2 = ADCProfiles[profile].cfg2;
+
+    r = ADCCalibrate();
+
+    ADC0->SC3 = ADCProfiles[profile].sc3;
+
+    // Time a conversion with the SysTick down counter, which wraps at most
+    // once in the time of a conversion.
+    start = SysTick->VAL;
+    ADCConvert(CrossingPins[0].probe);
+    end = SysTick->VAL;
+    ADCProfileCycles[profile] = (start >= end)
+        ? start - end : start + (SysTick->LOAD + 1) - end;
+
+    return r;
 }
 
 //  Initialise ADC .
 void Init_ADC(void) {
+    int n;
+
     // Enable clock to ports B.
     SIM->SCGC5 |= SIM_SCGC5_PORTB_MASK;
 
-    // Ensure no pull-up / pull-down selected.
-    PORTB->PCR[ADCPOS] &= ~PORT_PCR_PS_MASK;
+    // Ensure no pull-up / pull-down selected on any probe.
+    for (n = 0; n < CROSSINGS; n++)
+        PORTB->PCR[CrossingPins[n].probePos] &= ~PORT_PCR_PS_MASK;
 
     // Enable clock to ADC.
     SIM->SCGC6 |= (1UL << SIM_SCGC6_ADC0_SHIFT);
 
-    // Set the ADC0_CFG1 to 0xB5, which is 1011 0101
-    //   1 --> low power conversion
-    //   01 --> ADIV is divide by 2
-    //   1 --> ADLSMP is long sample time
-    //   01 --> MODE is 12 bit conversion
-    //   01 --> ADIClK is bus clock / 2
-    ADC0->CFG1 = 0xB5 ;
-
     // Set the ADC0_SC2 register to 0
     //   0 --> DATRG - s/w trigger
     //   0 --> ACFE - compare disable
@@ -83,6 +451,26 @@ void Init_ADC(void) {
     //   0 --> DMAEN - DMA is disabled
     //   00 -> REFSEL - defaults V_REFH and V_REFL selected
     ADC0->SC2 = 0 ;
+
+    // Calibrate and time every profile, ending with the one in use.
+    ADCSetProfile(ADC_PROFILE_FAST);
+    ADCSetProfile(ADC_PROFILE_BALANCED);
+    ADCSetProfile(ADC_PROFILE_LOWNOISE);
+
+    if (ADCSetProfile(ADC_PROFILE) != 0) {
+        // Error Handling.
+        while(1);
+    }
+
+#if ADC_SAMPLING == ADC_SAMPLING_DMA
+    Init_ADC_DMA();
+#elif ADC_SAMPLING == ADC_SAMPLING_TIMER
+    Init_ADC_Timer();
+#elif ADC_SAMPLING == ADC_SAMPLING_WINDOW
+    NVIC_SetPriority(ADC0_IRQn, 0); // Highest: it turns the lights off.
+    NVIC_ClearPendingIRQ(ADC0_IRQn);
+    NVIC_EnableIRQ(ADC0_IRQn);
+#endif
 }
 
 // Configure SysTick to interrupt every millisecond.
@@ -97,59 +485,175 @@ void Init_SysTick(void) {
     }
 }
 
+// Allow very low power run, for CLOCK_VLPR. SMC_PMPROT can only be written
+// once after reset.
+void Init_Clock(void) {
+    SMC->PMPROT = SMC_PMPROT_AVLP_MASK;
+}
+
+// Run TPM0 from OSCERCLK as a free running counter at STAMP_HZ, with its
+// overflow interrupt.
+void Init_Stamp(void) {
+    SIM->SCGC6 |= SIM_SCGC6_TPM0_MASK;
+    SIM->SOPT2 = (SIM->SOPT2 & ~SIM_SOPT2_TPMSRC_MASK) | SIM_SOPT2_TPMSRC(2);
+
+    TPM0->SC = 0; // Stop while configuring.
+    TPM0->CNT = 0;
+    TPM0->MOD = 0xffff;
+    TPM0->SC = TPM_SC_TOF_MASK; // Writing 1 clears the overflow flag.
+
+    NVIC_SetPriority(TPM0_IRQn, 64);
+    NVIC_ClearPendingIRQ(TPM0_IRQn);
+    NVIC_EnableIRQ(TPM0_IRQn);
+
+    // Count on the module clock, interrupt on overflow.
+    TPM0->SC = TPM_SC_CMOD(1) | TPM_SC_PS(STAMP_TPM_PS) | TPM_SC_TOIE_MASK;
+}
+
 
 // Combined initialisation.
 void PelicanConfig(void) {
+    Init_Clock();
+    Init_SysTick(); // First, to time the ADC profiles.
+    Init_Stamp(); // Before the button, which stamps its presses.
+    TraceInit(); // Before the ADC, so that record mode has every conversion.
     Init_ADC();
     Init_Button();
     Init_GPIO_Led();
-    Init_SysTick();
 }
 
 // -----------------------------------
 // GPIO outputs
 // -----------------------------------
 // Assumes all GPIO o/ps are in PortE.
-const uint32_t SignalPos[6] = {
-    RED_POS,
-    AMB_POS,
-    GRE_POS,
-    DWL_POS,
-    WLK_POS,
-    WAI_POS
-};
+uint32_t SignalPins[CROSSINGS];
+
+// Pins to turn on at the next commit.
+volatile uint32_t SignalShadow[CROSSINGS];
+
+// Set when a press is taken, until the WAIT output that it leads to is on.
+volatile int ButtonWaitPending[CROSSINGS];
 
 // Set a signal.
-void SignalSet(enum PelicanSignal ps) {
-    // Turn-on PTE pin.
-    PTE->PSOR |= MASK(SignalPos[ps]);
+void SignalSet(int n, enum PelicanSignal ps) {
+    SignalShadow[n] |= MASK(CrossingPins[n].signal[ps]);
 }
 
 // Clear a signal.
-void SignalReset(enum PelicanSignal ps) {
-    // Turn-off PTE pin.
-    PTE->PCOR |= MASK(SignalPos[ps]);
+void SignalReset(int n, enum PelicanSignal ps) {
+    SignalShadow[n] &= ~MASK(CrossingPins[n].signal[ps]);
+}
+
+// Set the signals in the mask and clear the others.
+void SignalWrite(int n, unsigned mask) {
+    const uint8_t *pos = CrossingPins[n].signal;
+    uint32_t pins = 0;
+    int ps;
+
+    for (ps = RED_S; ps <= WAIT_S; ps++)
+        if (mask & MASK(ps))
+            pins |= MASK(pos[ps]);
+
+    SignalShadow[n] = pins;
+}
+
+// Write the shadow to port E. The other pins of the port, the signals of the
+// other crossings among them, are kept, and interrupts are held off so that
+// SignalResetAll() from an interrupt cannot come between the read and the
+// write.
+void SignalCommit(int n) {
+    uint32_t on;
+
+    __disable_irq();
+    on = SignalShadow[n] & ~GPIO_E->PDOR; // Pins turned on by this commit.
+    GPIO_E->PDOR = (GPIO_E->PDOR & ~SignalPins[n]) | SignalShadow[n];
+    __enable_irq();
+
+    // WAIT is on for a press: the end of its latency.
+    if ((on & MASK(CrossingPins[n].signal[WAIT_S])) && ButtonWaitPending[n]) {
+        ButtonWaitPending[n] = 0;
+        SchedLatencyAdd(&ButtonLatency, StampNow() - ButtonTime[n]);
+    }
+}
+
+// Clear all the signals at once.
+void SignalResetAll(int n) {
+    GPIO_E->PCOR = SignalPins[n];
+    SignalShadow[n] = 0;
+}
+
+// Clear all the signals and time the safe state.
+void SignalSafe(int n, uint32_t detected) {
+    int on = (GPIO_E->PDOR & SignalPins[n]) != 0;
+
+    SignalResetAll(n);
+
+    if (on)
+        SchedLatencyRecord(&SafeLatency, detected);
 }
 
 // -----------------------------------
 // Measurement
 // -----------------------------------
-unsigned Measure(void) {
-    unsigned res = 0;
+#if ADC_SAMPLING == ADC_SAMPLING_DMA
+// Copy the latest samples from the DMA ring, oldest first.
+unsigned MeasureLatest(uint16_t *samples, unsigned n) {
+    // The DMA destination is the slot for the next sample.
+    unsigned next = (DMA0->DMA[0].DAR - (uint32_t) ADCRing) / 2;
+    unsigned written = (ADC_DMA_BYTES
+            - (DMA0->DMA[0].DSR_BCR & DMA_DSR_BCR_BCR_MASK)) / 2;
+    unsigned i;
 
-    // Write to ADC0_SC1A
-    //   0 --> AIEN Conversion interrupt diabled
-    //   0 --> DIFF single end conversion
-    //   01000 --> ADCH, selecting AD8
-    ADC0->SC1[0] = ADC_CHANNEL; // Writing to this clears the COCO flag.
+    if (ADCRingReloads == 0 && n > written)
+        n = written;
 
-    // Test the conversion complete flag, which is 1 when completed.
-    while (!(ADC0->SC1[0] & ADC_SC1_COCO_MASK)); // Empty loop.
+    if (n > ADC_RING_SIZE / 2)
+        n = ADC_RING_SIZE / 2;
 
-    // Read results from ADC0_RA as an unsigned integer.
-    res = ADC0->R[0] ; // Reading this clears the COCO flag.
-    return res;
+    for (i = 0; i < n; i++)
+        samples[i] = ADCRing[(next - n + i) & (ADC_RING_SIZE - 1)];
+
+    return n;
+}
+
+// Average of the latest samples from the DMA ring.
+unsigned MeasureAverage(unsigned n) {
+    uint16_t samples[ADC_RING_SIZE / 2];
+    unsigned sum = 0;
+    unsigned i;
+
+    n = MeasureLatest(samples, n);
+
+    for (i = 0; i < n; i++)
+        sum = sum + samples[i];
+
+    return (n) ? sum / n : 0;
+}
+
+// The conversions are already running: average the latest samples.
+unsigned Measure(int n) {
+    return MeasureAverage(ADC_RING_AVERAGE);
 }
+#elif ADC_SAMPLING == ADC_SAMPLING_TIMER
+// Average of the samples accumulated since the last call. If none has
+// completed since, the last sample is returned again.
+unsigned Measure(int n) {
+    uint32_t sum, count;
+
+    __disable_irq();
+    sum = ADCAccSum;
+    count = ADCAccCount;
+    ADCAccSum = 0;
+    ADCAccCount = 0;
+    __enable_irq();
+
+    return (count) ? sum / count : ADCLast;
+}
+#else
+unsigned Measure(int n) {
+    return ADCConvert(CrossingPins[n].probe);
+}
+#endif
 
 // -----------------------------------
 // Button test
@@ -159,62 +663,380 @@ unsigned Measure(void) {
 // and only one button access per cycle.
 
 volatile int SysTickCounter = 0;
-volatile int ButtonCounter = 0;
-volatile int ButtonPressed = 0;
+volatile int ButtonCounter[CROSSINGS];
+volatile uint32_t ButtonTime[CROSSINGS];
 
-// Tests whether the button is pressed.
-//   Test the button. If set, then clear the variable set by the interrupt.
-//   Return: Button status
-int ButtonTestReset(void) {
-    unsigned res = ButtonPressed ;
+// One ring per crossing, all posted by PORTD_IRQHandler.
+volatile struct SchedEvent ButtonRing[CROSSINGS][BUTTON_QUEUE];
+struct SchedQueue ButtonQueue[CROSSINGS] = {
+    {ButtonRing[0], BUTTON_QUEUE},
+#if CROSSINGS > 1
+    {ButtonRing[1], BUTTON_QUEUE},
+#endif
+};
 
-    if (res) {
-        ButtonPressed = 0;
-    }
+// Takes the oldest press from the queue.
+//   Return: 1 if a press was taken, 0 if the queue was empty
+int ButtonTestReset(int n) {
+    struct SchedEvent press;
 
-    return res;
+    TracePresses();
+    if (!SchedQueueGet(&ButtonQueue[n], &press))
+        return 0;
+
+    ButtonTime[n] = press.stamp;
+    ButtonWaitPending[n] = 1;
+
+    return 1;
+}
+
+// Discards all the queued presses.
+void ButtonClear(int n) {
+    TracePresses();
+    SchedQueueFlush(&ButtonQueue[n]);
+    ButtonWaitPending[n] = 0;
 }
 
 /*
  * Interrupt Handler:
  *
  *   - Clear the pending request.
- *   - Test the bit for pin BUTTON_POS (6) to see if it generated the interrupt.
+ *   - Test the bit for the button pin of each crossing to see if it
+ *     generated the interrupt.
+ *   - Queue a debounced press with its time stamp.
  */
 void PORTD_IRQHandler(void) {
+    uint32_t start = SysTick->VAL;
+    uint32_t stamp = StampNow(); // As close to the edge as possible.
+    uint32_t flags = PORTD->ISFR;
+    int n;
+
     NVIC_ClearPendingIRQ(PORTD_IRQn);
 
-    if ((PORTD->ISFR & MASK(BUTTON_POS))) {
-        if (ButtonCounter == 0 && ButtonPressed == 0) {
-            ButtonPressed = 1;
-            ButtonCounter = BUTTON_DELAY;
-            // Otherwise ignore it.
+    for (n = 0; n < CROSSINGS; n++) {
+        if ((flags & MASK(CrossingPins[n].button))) {
+            if (ButtonCounter[n] == 0) {
+                ButtonCounter[n] = BUTTON_DELAY;
+                SchedQueuePost(&ButtonQueue[n], SCHED_EVENT_BUTTON, n, stamp);
+                // Otherwise ignore it.
+            }
         }
     }
 
-    // Clear status flags .
-    PORTD->ISFR = 0xffffffff;
+    // Clear the status flags read; a press since then interrupts again.
+    PORTD->ISFR = flags;
+
+    IsrCyclesRecord(&SignalCycles.portd, start);
 }
 
 // -----------------------------------
 // SysTick
 // -----------------------------------
 
+volatile uint32_t SysTickTicks = 0;
+volatile struct IdleStats IdleStats;
+
+// SysTickNow() less the clocks counted by SysTick, and SysTickTicks, at the
+// last clock switch.
+uint32_t SysTickBase = 0;
+uint32_t SysTickBaseTicks = 0;
+
+// Time at which the current frame started.
+uint32_t FrameStart = 0;
+
+// 1 if the current frame is left out of the idle statistics.
+uint8_t FrameSkip = 0;
+
+// Time since start-up in core clocks.
+uint32_t SysTickNow(void) {
+    uint32_t ticks, val;
+
+    // Read again if a tick interrupt came between the two reads.
+    do {
+        ticks = SysTickTicks;
+        val = SysTick->VAL;
+    } while (ticks != SysTickTicks);
+
+    return SysTickBase + (ticks - SysTickBaseTicks) * (SysTick->LOAD + 1)
+        + (SysTick->LOAD - val);
+}
+
 // Wait for the SysTick counter to expire, then reset it.
 //   Param: number of ticks to set counter
 void WaitSysTickCounter(int ticks) {
+    uint32_t start = SysTickNow();
+    uint32_t end;
+
+    if (!FrameSkip) {
+        IdleStats.active = start - FrameStart;
+        if (IdleStats.active > IdleStats.maxActive)
+            IdleStats.maxActive = IdleStats.active;
+    }
+
+#if IDLE_MODE == IDLE_WFI
+    // Test and sleep with interrupts masked, so that a tick between the test
+    // and the WFI is not missed; a pending interrupt still ends the WFI.
+    __disable_irq();
+    while (SysTickCounter > 0) {
+        __WFI();
+        IdleStats.wakeups++;
+
+        __enable_irq(); // Run the interrupt that woke the core.
+        __disable_irq();
+    }
+    __enable_irq();
+#else
     while (SysTickCounter > 0);
+#endif
+
     SysTickCounter = ticks;
+
+    end = SysTickNow();
+    if (!FrameSkip) {
+        IdleStats.asleep = end - start;
+        IdleStats.frames++;
+        IdleStats.totalActive[ClockCurrent] += IdleStats.active;
+        IdleStats.totalAsleep[ClockCurrent] += IdleStats.asleep;
+    }
+    FrameSkip = 0;
+    FrameStart = end;
+}
+
+// Clear the idle statistics.
+void IdleStatsReset(void) {
+    int i;
+
+    IdleStats.frames = 0;
+    IdleStats.maxActive = 0;
+    IdleStats.wakeups = 0;
+    for (i = 0; i < CLOCK_PROFILES; i++) {
+        IdleStats.totalActive[i] = 0;
+        IdleStats.totalAsleep[i] = 0;
+    }
+}
+
+// Leave the current frame out of the idle statistics.
+void IdleStatsSkip(void) {
+    FrameSkip = 1;
 }
 
 // This function handles SysTick Handler.
 // Decrement the counters that are greater than zero.
 void SysTick_Handler(void) {
+    int n;
+
+    SysTickTicks++;
+    ClockStats.ticks[ClockCurrent]++;
+
+#if SCHEDULER
+    SchedTick();
+#endif
+
     if (SysTickCounter > 0x00) { // Check counter not already zero.
         SysTickCounter--; // Decrement towards zero.
     }
 
-    if (ButtonCounter > 0x00) { // Check counter not already zero.
-        ButtonCounter--; // Decrement towards zero.
+    for (n = 0; n < CROSSINGS; n++) {
+        if (ButtonCounter[n] > 0x00) { // Check counter not already zero.
+            ButtonCounter[n]--; // Decrement towards zero.
+        }
+    }
+}
+
+// -----------------------------------
+// Time stamps
+// -----------------------------------
+
+// Overflows of TPM0 counted by its interrupt: the high half of StampNow().
+volatile uint32_t StampHigh = 0;
+
+// Time since Init_Stamp() in us.
+uint32_t StampNow(void) {
+    uint32_t high, count, sc;
+
+    // Read again if the overflow interrupt came between the reads.
+    do {
+        high = StampHigh;
+        count = TPM0->CNT;
+        sc = TPM0->SC;
+    } while (high != StampHigh);
+
+    // An overflow not yet counted, because interrupts are masked or a higher
+    // priority interrupt is running. A low count was read after it.
+    if ((sc & TPM_SC_TOF_MASK) && count < 0x8000)
+        high++;
+
+    return (high << 16) | count;
+}
+
+// Count an overflow of TPM0.
+void TPM0_IRQHandler(void) {
+    TPM0->SC |= TPM_SC_TOF_MASK; // Writing 1 clears the flag.
+    StampHigh++;
+}
+
+// -----------------------------------
+// Clock
+// -----------------------------------
+
+volatile enum ClockProfile ClockCurrent = CLOCK_RUN; // Set by SystemInit().
+volatile struct ClockStats ClockStats;
+
+#define PMSTAT_RUN (0x01)  // SMC_PMSTAT in run.
+#define PMSTAT_VLPR (0x04) // SMC_PMSTAT in very low power run.
+
+// SIM_CLKDIV1 of each profile: the core clock is MCGOUTCLK / (OUTDIV1 + 1)
+// and the bus clock the core clock / (OUTDIV4 + 1).
+const uint32_t ClockDividers[CLOCK_PROFILES] = {
+    SIM_CLKDIV1_OUTDIV1(1) | SIM_CLKDIV1_OUTDIV4(1), // PLL 96 MHz: 48, 24.
+    SIM_CLKDIV1_OUTDIV1(0) | SIM_CLKDIV1_OUTDIV4(2), // FLL: 41.94, 13.98.
+    SIM_CLKDIV1_OUTDIV1(0) | SIM_CLKDIV1_OUTDIV4(0), // Crystal: 8, 8.
+    SIM_CLKDIV1_OUTDIV1(0) | SIM_CLKDIV1_OUTDIV4(4)  // Fast IRC: 4, 0.8.
+};
+
+// Leave the profile in use for FBE: MCGOUTCLK from the 8 MHz crystal, with
+// the FLL and the PLL bypassed. Every profile is entered from FBE.
+void clockToFBE(void) {
+    switch (ClockCurrent) {
+    case CLOCK_VLPR:
+        // The clocks may only change in run: leave VLPR, then BLPI to FBI.
+        SMC->PMCTRL = SMC_PMCTRL_RUNM(0);
+        while ((SMC->PMSTAT & SMC_PMSTAT_PMSTAT_MASK) != PMSTAT_RUN);
+        MCG->C2 &= ~MCG_C2_LP_MASK;
+        // Fall through: FBI to FBE is as FEI to FBE.
+
+    case CLOCK_FEI:
+        // Start the crystal, then select it and give the FLL its divided
+        // reference, as SystemInit() does.
+        OSC0->CR = OSC_CR_ERCLKEN_MASK | OSC_CR_SC2P_MASK | OSC_CR_SC16P_MASK;
+        MCG->C2 = (MCG->C2 & MCG_C2_IRCS_MASK) | MCG_C2_RANGE0(2)
+            | MCG_C2_EREFS0_MASK;
+        while (!(MCG->S & MCG_S_OSCINIT0_MASK));
+        MCG->C1 = MCG_C1_CLKS(2) | MCG_C1_FRDIV(3) | MCG_C1_IRCLKEN_MASK;
+        while (MCG->S & MCG_S_IREFST_MASK);
+        while ((MCG->S & MCG_S_CLKST_MASK) != MCG_S_CLKST(2));
+        MCG->C2 &= ~MCG_C2_IRCS_MASK; // Back to the slow IRC.
+        break;
+
+    case CLOCK_BLPE:
+        MCG->C2 &= ~MCG_C2_LP_MASK;
+        break;
+
+    default:
+        // PEE to PBE, then turn the PLL off.
+        MCG->C1 = MCG_C1_CLKS(2) | MCG_C1_FRDIV(3) | MCG_C1_IRCLKEN_MASK;
+        while ((MCG->S & MCG_S_CLKST_MASK) != MCG_S_CLKST(2));
+        MCG->C6 &= ~MCG_C6_PLLS_MASK;
+        while (MCG->S & MCG_S_PLLST_MASK);
+        break;
+    }
+}
+
+// Enter a profile from FBE. The dividers are set first, while the core runs
+// from the crystal, so that no clock goes over its limit.
+//   Param: profile
+void clockFromFBE(enum ClockProfile profile) {
+    SIM->CLKDIV1 = ClockDividers[profile];
+
+    switch (profile) {
+    case CLOCK_VLPR:
+        // FBI on the fast IRC, undivided, then BLPI and very low power run.
+        MCG->SC &= ~MCG_SC_FCRDIV_MASK;
+        MCG->C2 |= MCG_C2_IRCS_MASK;
+        while (!(MCG->S & MCG_S_IRCST_MASK));
+        MCG->C1 = MCG_C1_CLKS(1) | MCG_C1_IREFS_MASK | MCG_C1_IRCLKEN_MASK;
+        while ((MCG->S & MCG_S_CLKST_MASK) != MCG_S_CLKST(1));
+        MCG->C2 |= MCG_C2_LP_MASK;
+        SMC->PMCTRL = SMC_PMCTRL_RUNM(2);
+        while ((SMC->PMSTAT & SMC_PMSTAT_PMSTAT_MASK) != PMSTAT_VLPR);
+        break;
+
+    case CLOCK_FEI:
+        // FLL on the slow IRC, mid range: 32768 Hz * 1280.
+        MCG->C4 = (MCG->C4 & ~(MCG_C4_DMX32_MASK | MCG_C4_DRST_DRS_MASK))
+            | MCG_C4_DRST_DRS(1);
+        MCG->C1 = MCG_C1_CLKS(0) | MCG_C1_IREFS_MASK | MCG_C1_IRCLKEN_MASK;
+        while (!(MCG->S & MCG_S_IREFST_MASK));
+        while ((MCG->S & MCG_S_CLKST_MASK) != MCG_S_CLKST(0));
+        break;
+
+    case CLOCK_BLPE:
+        MCG->C2 |= MCG_C2_LP_MASK;
+        break;
+
+    default:
+        // PBE with the PLL at 8 MHz / 2 * 24, then PEE.
+        MCG->C5 = MCG_C5_PRDIV0(1);
+        MCG->C6 |= MCG_C6_PLLS_MASK;
+        while (!(MCG->S & MCG_S_PLLST_MASK));
+        while (!(MCG->S & MCG_S_LOCK0_MASK));
+        MCG->C1 = MCG_C1_CLKS(0) | MCG_C1_FRDIV(3) | MCG_C1_IRCLKEN_MASK;
+        while ((MCG->S & MCG_S_CLKST_MASK) != MCG_S_CLKST(3));
+        break;
     }
 }
+
+// Give the ADC the clock of its profile for the new bus clock. The
+// conversions of the sampling mode are stopped for the calibration and then
+// started again.
+//   Return: as ADCSetProfile()
+int adcRetune(void) {
+    uint32_t sc1 = ADC0->SC1[0] & (ADC_SC1_AIEN_MASK | ADC_SC1_ADCH_MASK);
+    uint32_t sc2 = ADC0->SC2;
+    uint32_t adco = ADC0->SC3 & ADC_SC3_ADCO_MASK;
+    int r;
+
+#if ADC_SAMPLING == ADC_SAMPLING_TIMER
+    PIT->CHANNEL[0].TCTRL = 0;
+#endif
+    ADC0->SC1[0] = ADC_SC1_ADCH(0x1f); // ADCH 11111 disables the ADC.
+    ADC0->SC2 = 0; // Software trigger, no compare, no DMA.
+
+    r = ADCSetProfile(adcProfile);
+
+    ADC0->SC2 = sc2;
+    ADC0->SC3 |= adco;
+
+    // Continuous and triggered conversions start with a write to SC1.
+    if (adco || (sc2 & ADC_SC2_ADTRG_MASK))
+        ADC0->SC1[0] = sc1;
+
+#if ADC_SAMPLING == ADC_SAMPLING_TIMER
+    // The PIT runs from the bus clock, and the conversion has a new time.
+    PIT->CHANNEL[0].LDVAL = adcTriggerPeriod(adcProfile) - 1;
+    PIT->CHANNEL[0].TCTRL = PIT_TCTRL_TEN_MASK;
+#endif
+    return r;
+}
+
+// Switch to a clock profile.
+int ClockSetProfile(enum ClockProfile profile) {
+    uint32_t now;
+    int r;
+
+    if (profile == ClockCurrent)
+        return 0;
+
+    clockToFBE();
+    clockFromFBE(profile);
+    SystemCoreClockUpdate();
+
+    // Restart the tick at the new clock. SysTickNow() carries on from the
+    // time it had reached: the counter reloads from LOAD on the clock after
+    // SysTick_Config() clears it, so the base is 'now' less the clocks it has
+    // counted down since.
+    __disable_irq();
+    now = SysTickNow();
+    Init_SysTick();
+    while (SysTick->VAL == 0); // Empty loop, for the reload.
+    SysTickBase = now - (SysTick->LOAD - SysTick->VAL);
+    SysTickBaseTicks = SysTickTicks;
+    ClockCurrent = profile;
+    __enable_irq();
+
+    r = adcRetune();
+
+    ClockStats.switches++;
+    ClockStats.calFailures += r;
+    return r;
+}
@@ -0,0 +1,238 @@
+#include <MKL25Z4.H>
+#include "pelican.h"
+#include "sched.h"
+
+/* -------------------------------------
+ * Event-driven scheduler.
+ *
+ * Software timers are kept in a timer wheel of SCHED_WHEEL slots, one per
+ * SysTick. A timer is linked into the slot of its expiry tick, so each tick
+ * only looks at the timers of one slot. A firing timer queues its event;
+ * interrupts queue events in queues of their own. The main loop sleeps in
+ * SchedWait() until an event is queued, so it runs as soon as the interrupt
+ * that posted it returns, rather than at the next frame. Events are queued,
+ * not flags, so a burst of them is not merged into one.
+ * -------------------------------------
+ */
+
+// Current tick of the wheel.
+uint32_t SchedNow = 0;
+
+// Slots of the wheel, each a list of timers.
+struct SchedTimer *SchedSlots[SCHED_WHEEL];
+
+// Timer events, and the queues watched by SchedWait().
+volatile struct SchedEvent SchedTimerRing[SCHED_TIMER_QUEUE];
+struct SchedQueue SchedTimerQueue = {SchedTimerRing, SCHED_TIMER_QUEUE};
+struct SchedQueue *SchedWatched = 0;
+
+volatile struct SchedLatency ButtonLatency = {0, 0, 0xffffffff, 0, 0};
+volatile struct SchedLatency SafeLatency = {0, 0, 0xffffffff, 0, 0};
+
+// -----------------------------------
+// Timers
+// -----------------------------------
+
+// Link a timer into the slot of its expiry. Interrupts must be masked.
+void SchedInsert(struct SchedTimer *t) {
+    struct SchedTimer **slot = &SchedSlots[t->expiry & (SCHED_WHEEL - 1)];
+
+    t->next = *slot;
+    *slot = t;
+    t->running = 1;
+}
+
+// Unlink a timer from its slot. Interrupts must be masked.
+void SchedRemove(struct SchedTimer *t) {
+    struct SchedTimer **p = &SchedSlots[t->expiry & (SCHED_WHEEL - 1)];
+
+    while (*p != 0 && *p != t)
+        p = &(*p)->next;
+
+    if (*p == t)
+        *p = t->next;
+
+    t->running = 0;
+}
+
+// Start a timer, or restart it if running.
+void SchedTimerStart(struct SchedTimer *t, uint32_t delay, uint32_t period,
+        unsigned event) {
+    __disable_irq();
+
+    if (t->running)
+        SchedRemove(t);
+
+    t->expiry = SchedNow + ((delay) ? delay : 1);
+    t->period = period;
+    t->event = event;
+    SchedInsert(t);
+
+    __enable_irq();
+}
+
+// Stop a timer.
+void SchedTimerStop(struct SchedTimer *t) {
+    __disable_irq();
+
+    if (t->running)
+        SchedRemove(t);
+
+    __enable_irq();
+}
+
+// Advance the wheel by one tick and fire the timers that are due. Timers in
+// the slot that expire in a later turn of the wheel are left in place.
+void SchedTick(void) {
+    struct SchedTimer **p;
+    struct SchedTimer *t;
+    uint32_t stamp = StampNow();
+
+    SchedNow++;
+    p = &SchedSlots[SchedNow & (SCHED_WHEEL - 1)];
+
+    while ((t = *p) != 0) {
+        if (t->expiry != SchedNow) {
+            p = &t->next;
+            continue;
+        }
+
+        *p = t->next; // Unlink, then re-link if periodic.
+        t->running = 0;
+        SchedQueuePost(&SchedTimerQueue, t->event, 0, stamp);
+
+        if (t->period) {
+            t->expiry = SchedNow + t->period;
+
+            // A period of a multiple of the wheel size lands in this slot
+            // again, ahead of 'p'; it is only tested at the next turn.
+            SchedInsert(t);
+        }
+    }
+}
+
+// -----------------------------------
+// Event queues
+// -----------------------------------
+
+// Queue an event (producer only). The slot is written before 'head', which
+// publishes it; the consumer does not read a slot until it sees the new
+// 'head'. Volatile accesses keep that order, and the M0+ does not reorder
+// them, as the interrupt and the main loop run on the same core.
+int SchedQueuePost(struct SchedQueue *q, unsigned type, unsigned data,
+        uint32_t stamp) {
+    unsigned head = q->head;
+    unsigned queued = head - q->tail;
+    volatile struct SchedEvent *slot;
+
+    if (queued >= q->size) {
+        q->overflows++;
+        return 0;
+    }
+
+    slot = &q->ring[head & (q->size - 1)];
+    slot->type = type;
+    slot->data = data;
+    slot->stamp = stamp;
+    q->head = head + 1; // Publishes the event.
+
+    if (queued + 1 > q->peak)
+        q->peak = queued + 1;
+
+    return 1;
+}
+
+// Copy the event at 'index' out of the ring.
+void SchedCopy(struct SchedQueue *q, unsigned index, struct SchedEvent *e) {
+    volatile struct SchedEvent *slot = &q->ring[index & (q->size - 1)];
+
+    e->type = slot->type;
+    e->data = slot->data;
+    e->stamp = slot->stamp;
+}
+
+// Take the oldest event (consumer only).
+int SchedQueueGet(struct SchedQueue *q, struct SchedEvent *e) {
+    unsigned tail = q->tail;
+
+    if (tail == q->head)
+        return 0;
+
+    SchedCopy(q, tail, e);
+    q->tail = tail + 1; // Frees the slot for the producer.
+
+    return 1;
+}
+
+// Copy the oldest event not yet reported, and leave it queued (consumer
+// only). Events taken since the last call are skipped.
+int SchedQueuePeek(struct SchedQueue *q, struct SchedEvent *e) {
+    if ((int) (q->seen - q->tail) < 0)
+        q->seen = q->tail;
+
+    if (q->seen == q->head)
+        return 0;
+
+    SchedCopy(q, q->seen, e);
+    q->seen++;
+
+    return 1;
+}
+
+// Discard all the queued events (consumer only).
+void SchedQueueFlush(struct SchedQueue *q) {
+    q->tail = q->head;
+}
+
+// Have SchedWait() report the new events of a queue.
+void SchedWatch(struct SchedQueue *q) {
+    q->seen = q->tail;
+    q->watch = SchedWatched;
+    SchedWatched = q;
+}
+
+// Report the next new event of a watched queue, or take the next timer
+// event.
+int SchedNext(struct SchedEvent *e) {
+    struct SchedQueue *q;
+
+    for (q = SchedWatched; q != 0; q = q->watch)
+        if (SchedQueuePeek(q, e))
+            return 1;
+
+    return SchedQueueGet(&SchedTimerQueue, e);
+}
+
+// Sleep until an event is queued, then report or take it.
+unsigned SchedWait(struct SchedEvent *e) {
+    // Test and sleep with interrupts masked, as in WaitSysTickCounter().
+    __disable_irq();
+    while (!SchedNext(e)) {
+        __WFI();
+        __enable_irq(); // Run the interrupt that woke the core.
+        __disable_irq();
+    }
+    __enable_irq();
+
+    return e->type;
+}
+
+// -----------------------------------
+// Latency
+// -----------------------------------
+
+// Record a latency that ends now.
+void SchedLatencyRecord(volatile struct SchedLatency *l, uint32_t start) {
+    SchedLatencyAdd(l, SysTickNow() - start);
+}
+
+// Record a latency.
+void SchedLatencyAdd(volatile struct SchedLatency *l, uint32_t latency) {
+    l->count++;
+    l->sum += latency;
+    l->last = latency;
+    if (latency < l->min)
+        l->min = latency;
+    if (latency > l->max)
+        l->max = latency;
+}
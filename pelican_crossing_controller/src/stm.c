@@ -0,0 +1,653 @@
+#include <MKL25Z4.H>
+#include "pelican.h"
+#include "stm.h"
+#include "sched.h"
+#include "trace.h"
+#include "calib.h"
+
+/* -------------------------------------
+ * Table-driven State Transition Model.
+ *
+ * Each state is one row of StmTable, held in flash. The row gives the lights
+ * that are on, how long the state lasts, where it goes next and which failure
+ * check and button behaviour apply. executeSTM() interprets the row for the
+ * current state of a crossing once per frame; it has no loops other than over
+ * the 6 signals, so every frame runs in a bounded number of cycles.
+ *
+ * All that changes at run time is held in the struct Crossing of each
+ * crossing, so that the crossings driven by the board run the same code and
+ * table side by side, and a failure of one does not stop the others.
+ * -------------------------------------
+ */
+
+struct Crossing Crossings[CROSSINGS];
+
+/*----------------------------------------------------------------------------*
+  Puts a crossing in its reset state.
+ *----------------------------------------------------------------------------*/
+void CrossingInit(struct Crossing *c, int index) {
+    int ps;
+
+    c->index = index;
+    c->state = REDINIT;
+    c->cycleCounter = 0;
+    c->redFailure = 0;
+    c->amberFailure = 0;
+    c->initCounter = 1;
+    c->measuredProbe = 0;
+    for (ps = RED_S; ps <= WAIT_S; ps++)
+        c->calibrated[ps] = 0;
+
+    c->sampler.state = -1;
+    c->sampler.lit = -1;
+#if ADC_SAMPLING == ADC_SAMPLING_WINDOW
+    c->windowState = -1;
+    c->windowFrames = 0;
+#endif
+}
+
+/*----------------------------------------------------------------------------*
+  Transition table, indexed by state.
+ *----------------------------------------------------------------------------*/
+STM_TABLE_CONST struct StmRow StmTable[NUMSTATES] = {
+    // Rows are in state order: outputs, seconds, next, amberAlt, check, lamp,
+    // button, window, rate, clock.
+    // --- REDINIT --- //
+    {SIG(RED_S), 1, AMBERINIT, REDINIT,
+        CHECK_CALIBRATE, RED_S, BUTTON_INIT, 16, 1, CLOCK_RUN},
+    // --- AMBERINIT --- //
+    {SIG(AMBER_S), 1, GREENINIT, AMBERFAILUREINIT,
+        CHECK_CALIBRATE, AMBER_S, BUTTON_INIT, 16, 1, CLOCK_RUN},
+    // --- AMBERFAILUREINIT --- //
+    {SIG(RED_S), 1, GREENINIT, AMBERFAILUREINIT,
+        CHECK_CALIBRATE, RED_S, BUTTON_INIT, 16, 1, CLOCK_RUN},
+    // --- GREENINIT --- //
+    {SIG(GREEN_S), 1, DONTWALKINIT, GREENINIT,
+        CHECK_CALIBRATE, GREEN_S, BUTTON_INIT, 16, 1, CLOCK_RUN},
+    // --- DONTWALKINIT --- //
+    {SIG(DONTWALK_S), 1, WALKINIT, DONTWALKINIT,
+        CHECK_CALIBRATE, DONTWALK_S, BUTTON_INIT, 16, 1, CLOCK_RUN},
+    // --- WALKINIT --- //
+    {SIG(WALK_S), 1, WAITINIT, WALKINIT,
+        CHECK_CALIBRATE, WALK_S, BUTTON_INIT, 16, 1, CLOCK_RUN},
+    // --- WAITINIT --- //
+    {SIG(WAIT_S), 1, REDINIT, WAITINIT,
+        CHECK_CALIBRATE, WAIT_S, BUTTON_INIT, 16, 1, CLOCK_RUN},
+    // --- REDANDDONTWALK --- //
+    {SIG(RED_S) | SIG(DONTWALK_S), T4,
+        AMBERANDREDON, REDANDDONTWALK, CHECK_RED, 0, BUTTON_IGNORE, 4, 1,
+        CLOCK_RUN},
+    // --- WAITFLASHINGON --- //
+    {SIG(WAIT_S), T7, WAITFLASHINGOFF, WAITFLASHINGON,
+        CHECK_NONE, 0, BUTTON_IGNORE, 4, 1, CLOCK_RUN},
+    // --- WAITFLASHINGOFF --- //
+    {0, T7, WAITFLASHINGON, WAITFLASHINGOFF,
+        CHECK_NONE, 0, BUTTON_IGNORE, 4, 1, CLOCK_RUN},
+    // --- GREENON --- //
+    {SIG(GREEN_S) | SIG(DONTWALK_S), 0, WAITON, GREENON,
+        CHECK_RED, 0, BUTTON_REQUEST, 4, 1, CLOCK_IDLE},
+    // --- WAITON --- //
+    {SIG(GREEN_S) | SIG(DONTWALK_S) | SIG(WAIT_S), T6,
+        AMBERON, WAITON, CHECK_RED, 0, BUTTON_IGNORE, 4, 1, CLOCK_RUN},
+    // --- AMBERON --- //
+    {SIG(AMBER_S) | SIG(DONTWALK_S) | SIG(WAIT_S), T1,
+        REDON, AMBERFAILURE, CHECK_AMBER, 0, BUTTON_IGNORE, 4, 1, CLOCK_RUN},
+    // --- AMBERFAILURE --- //
+    {SIG(RED_S) | SIG(DONTWALK_S) | SIG(WAIT_S), T1,
+        REDON, AMBERFAILURE, CHECK_RED, 0, BUTTON_IGNORE, 4, 1, CLOCK_RUN},
+    // --- REDON --- //
+    {SIG(RED_S) | SIG(DONTWALK_S) | SIG(WAIT_S), T2,
+        WALKON, REDON, CHECK_RED, 0, BUTTON_IGNORE, 4, 1, CLOCK_RUN},
+    // --- WALKON --- //
+    {SIG(RED_S) | SIG(WALK_S), T3,
+        DONTWALKON, WALKON, CHECK_RED, 0, BUTTON_IGNORE, 4, 1, CLOCK_RUN},
+    // --- DONTWALKON --- //
+    {SIG(RED_S) | SIG(DONTWALK_S), T4,
+        AMBERANDREDON, DONTWALKON, CHECK_RED, 0, BUTTON_IGNORE, 4, 1,
+        CLOCK_RUN},
+    // --- AMBERANDREDON --- //
+    {SIG(RED_S) | SIG(AMBER_S) | SIG(DONTWALK_S), T5,
+        GREENON, AMBERFAILUREANDREDON, CHECK_AMBER, 0, BUTTON_CLEAR, 4, 1,
+        CLOCK_RUN},
+    // --- AMBERFAILUREANDREDON --- //
+    {SIG(RED_S) | SIG(DONTWALK_S), T5,
+        GREENON, AMBERFAILUREANDREDON, CHECK_RED, 0, BUTTON_CLEAR, 4, 1,
+        CLOCK_RUN},
+};
+
+/*----------------------------------------------------------------------------*
+  Probe sampler.
+
+  The last 'window' samples of the current state, one every 'rate' frames,
+  are kept in a ring with their running sum, so that a new reading is ready
+  after every sample once the window is full. The window is restarted when
+  the state changes, so a reading never mixes the lights of two states, and
+  the first frame of a state is not sampled while its lights settle. While
+  the window fills, readings are made from 1, 2, 4... samples, so the first
+  check of a state is not held back by the size of the window.
+ *----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*
+  Restarts the window for a state.
+ *----------------------------------------------------------------------------*/
+void samplerReset(struct Crossing *c, int state) {
+    struct StmSampler *s = &c->sampler;
+    unsigned n;
+
+    s->state = state;
+    s->head = 0;
+    s->count = 0;
+    s->sum = 0;
+    // Skip the frame that changes the lights, unless they changed already.
+    s->wait = (state == s->lit) ? 1 : 2;
+
+    s->shift = 0;
+    for (n = 1; n < PROBE_SCALE; n <<= 1)
+        s->shift++;
+}
+
+#if SAMPLER_FILTER == SAMPLER_MEDIAN
+/*----------------------------------------------------------------------------*
+  Replaces 'old' (if the window is full) by 'sample' in the sorted copy.
+ *----------------------------------------------------------------------------*/
+void samplerSort(struct StmSampler *s, unsigned old, unsigned sample,
+        int full) {
+    unsigned n = s->count;
+    unsigned i = 0;
+
+    // Take out the oldest sample.
+    if (full) {
+        while (s->sorted[i] != old)
+            i++;
+        for (n--; i < n; i++)
+            s->sorted[i] = s->sorted[i + 1];
+    }
+
+    // Insertion step for the new one.
+    for (i = n; i > 0 && s->sorted[i - 1] > sample; i--)
+        s->sorted[i] = s->sorted[i - 1];
+    s->sorted[i] = sample;
+}
+#endif
+
+/*----------------------------------------------------------------------------*
+  Takes a sample if one is due in this frame.
+  Returns 1 if a new reading is in measuredProbe, 0 otherwise.
+ *----------------------------------------------------------------------------*/
+int samplerUpdate(struct Crossing *c, int state) {
+    struct StmSampler *s = &c->sampler;
+    unsigned window = StmTable[state].window;
+    unsigned sample, old;
+    int full;
+
+    if (state != s->state)
+        samplerReset(c, state);
+
+    if (--s->wait != 0)
+        return 0;
+    s->wait = StmTable[state].rate;
+
+    sample = Measure(c->index);
+    old = s->samples[s->head];
+    full = (s->count == window);
+
+#if SAMPLER_FILTER == SAMPLER_MEDIAN
+    samplerSort(s, old, sample, full);
+#endif
+
+    // Running sum: the new sample in, the oldest out.
+    s->sum = s->sum + sample - ((full) ? old : 0);
+    s->samples[s->head] = sample;
+    s->head = (s->head + 1) & (window - 1);
+
+    // Filling: only a power of 2 of samples makes a reading.
+    if (!full) {
+        s->count++;
+        if (s->count & (s->count - 1))
+            return 0;
+        if (s->count > 1)
+            s->shift--;
+    }
+
+#if SAMPLER_FILTER == SAMPLER_MEDIAN
+    // Mean of the two middle samples (the same one for an odd count).
+    c->measuredProbe = (s->sorted[(s->count - 1) / 2] +
+        s->sorted[s->count / 2]) * (PROBE_SCALE / 2);
+#else
+    c->measuredProbe = s->sum << s->shift;
+#endif
+
+    // Turn on GREEN LED for low voltage and RED for high.
+    GPIO_B->PSOR = MASK(RED_LED_POS) | MASK(GREEN_LED_POS);
+
+    if (c->measuredProbe >= MV_TO_PROBE(HIGHTHRESHOLD))
+        GPIO_B->PCOR = MASK(RED_LED_POS);
+    else if (c->measuredProbe < MV_TO_PROBE(LOWTHRESHOLD))
+        GPIO_B->PCOR = MASK(GREEN_LED_POS);
+
+    TraceRecord(TRACE_CROSSING(c->index, TRACE_PROBE), state,
+            c->measuredProbe);
+    return 1;
+}
+
+/*----------------------------------------------------------------------------*
+  Builds the limits of every checked state from the calibrated readings, once
+  the initiation sequence has ended. The expected reading of a state is the
+  sum of the calibrated readings of the lamps that are on; the limits are
+  the readings within TOLERANCE percent of it, rounded inwards.
+ *----------------------------------------------------------------------------*/
+void StmLimitsBuild(struct Crossing *c) {
+    unsigned expected;
+    int state, ps;
+
+    for (state = 0; state < NUMSTATES; state++) {
+        expected = 0;
+        for (ps = RED_S; ps <= WAIT_S; ps++)
+            if (StmTable[state].outputs & SIG(ps))
+                expected = expected + c->calibrated[ps];
+
+        c->limits[state].low = (expected * (100 - TOLERANCE) + 99) / 100;
+        c->limits[state].high = expected * (100 + TOLERANCE) / 100;
+    }
+}
+
+/*----------------------------------------------------------------------------*
+  Returns 1 if a probe reading is outside the limits of a state.
+ *----------------------------------------------------------------------------*/
+int outOfWindow(const struct Crossing *c, unsigned probe, int state) {
+    return (probe < c->limits[state].low) || (probe > c->limits[state].high);
+}
+
+/*----------------------------------------------------------------------------*
+  Returns the state entered after 'state', using the AMBER substitute once
+  AMBER has failed.
+ *----------------------------------------------------------------------------*/
+int nextState(const struct Crossing *c, int state) {
+    return (c->amberFailure) ? StmTable[state].amberAlt : state;
+}
+
+/*----------------------------------------------------------------------------*
+  Takes the oldest press, if any, and traces the time it waited.
+  Returns 1 if a press was taken, 0 otherwise.
+ *----------------------------------------------------------------------------*/
+int buttonTake(struct Crossing *c, int state) {
+    if (!ButtonTestReset(c->index))
+        return 0;
+
+    TraceRecord(TRACE_CROSSING(c->index, TRACE_BUTTON), state,
+            StampNow() - ButtonTime[c->index]);
+    return 1;
+}
+
+/*----------------------------------------------------------------------------*
+  Returns the check that failed in a state, given a raw sample taken after
+  the failure. In a CHECK_AMBER state, the failure is AMBER's only if the
+  current gained or lost (a short draws twice the current, an open none)
+  matches AMBER within TOLERANCE of the expected reading, and better than
+  any other lamp that is on. A fault of RED, DONTWALK or WAIT, or one that
+  matches another lamp as well, is a CHECK_RED failure: all the lights go
+  off. Should noise make a fault of another lamp look like AMBER's, the
+  CHECK_RED check of the 'amberAlt' row, without AMBER, still finds it.
+ *----------------------------------------------------------------------------*/
+int failedCheck(const struct Crossing *c, int state, unsigned sample) {
+    unsigned outputs = StmTable[state].outputs;
+    unsigned probe = sample * PROBE_SCALE;
+    unsigned expected = 0, change, margin, amber, other;
+    int ps;
+
+    if (StmTable[state].check != CHECK_AMBER)
+        return StmTable[state].check;
+
+    for (ps = RED_S; ps <= WAIT_S; ps++)
+        if (outputs & SIG(ps))
+            expected = expected + c->calibrated[ps];
+
+    change = (probe > expected) ? probe - expected : expected - probe;
+    margin = expected * TOLERANCE / 100;
+    amber = (change > c->calibrated[AMBER_S]) ?
+        change - c->calibrated[AMBER_S] : c->calibrated[AMBER_S] - change;
+    if (amber > margin)
+        return CHECK_RED;
+
+    for (ps = RED_S; ps <= WAIT_S; ps++) {
+        if (ps == AMBER_S || !(outputs & SIG(ps)))
+            continue;
+        other = (change > c->calibrated[ps]) ?
+            change - c->calibrated[ps] : c->calibrated[ps] - change;
+        if (other <= amber)
+            return CHECK_RED;
+    }
+
+    return CHECK_AMBER;
+}
+
+/*----------------------------------------------------------------------------*
+  Handles a failure detected in the current state.
+ *----------------------------------------------------------------------------*/
+int stmFailure(struct Crossing *c, int curr_state, int check) {
+    uint32_t detected = SysTickNow();
+
+    // The cached calibration may be that of a lamp since changed.
+    CalibDrop(c);
+
+    // AMBER failure: carry on with RED instead.
+    if (check == CHECK_AMBER) {
+        c->amberFailure = 1;
+        TraceRecord(TRACE_CROSSING(c->index, TRACE_FAILURE), curr_state,
+                check);
+        return StmTable[curr_state].amberAlt;
+    }
+
+    // RED light or DONTWALK light failure: all the lights off now, not at
+    // the end of the frame.
+    c->redFailure = 1;
+    SignalSafe(c->index, detected);
+    // Once the lights are off.
+    TraceRecord(TRACE_CROSSING(c->index, TRACE_FAILURE), curr_state, check);
+    c->cycleCounter = 0;
+    return WAITFLASHINGON;
+}
+
+#if ADC_SAMPLING == ADC_SAMPLING_WINDOW
+/*----------------------------------------------------------------------------*
+  Loads the ADC compare window with the limits of a state, in raw counts. A
+  RED check window turns the lights off from the interrupt.
+ *----------------------------------------------------------------------------*/
+void windowLoad(const struct Crossing *c, int state) {
+    ADCWindowSet(c->limits[state].low / PROBE_SCALE,
+            c->limits[state].high / PROBE_SCALE,
+            StmTable[state].check == CHECK_RED);
+}
+
+/*----------------------------------------------------------------------------*
+  Takes a failure caught by the ADC window, if any.
+  Returns the state it leads to, or -1 if the window has not tripped.
+ *----------------------------------------------------------------------------*/
+int windowTrip(struct Crossing *c, int curr_state) {
+    struct SchedEvent trip;
+
+    if (!SchedQueueGet(&ADCQueue, &trip))
+        return -1;
+
+    return stmFailure(c, curr_state, (ADCWindowSafe) ? CHECK_RED
+            : failedCheck(c, curr_state, trip.data));
+}
+#endif
+
+/*----------------------------------------------------------------------------*
+  Lights the next state at once, ahead of its first frame. An ADC window of
+  the current state is stopped first, as it would trip on the new lights.
+ *----------------------------------------------------------------------------*/
+void lightNext(struct Crossing *c, int next) {
+#if ADC_SAMPLING == ADC_SAMPLING_WINDOW
+    ADCWindowOff();
+#endif
+    SignalWrite(c->index, StmTable[next].outputs);
+    c->sampler.lit = next;
+}
+
+/*----------------------------------------------------------------------------*
+  Executes one frame of the STM by interpreting the row for the current state.
+ *----------------------------------------------------------------------------*/
+int stmFrame(struct Crossing *c, int curr_state) {
+    const struct StmRow *row = &StmTable[curr_state];
+    int leaving = (row->seconds != 0) &&
+        (c->cycleCounter >= CYCLESPERSEC * row->seconds);
+#if ADC_SAMPLING == ADC_SAMPLING_WINDOW
+    // Failure caught by the ADC window since the last frame.
+    int trip = windowTrip(c, curr_state);
+
+    if (trip >= 0)
+        return trip;
+
+    // Clear the window before the lights change.
+    if (curr_state != c->windowState) {
+        ADCWindowOff();
+        c->windowState = curr_state;
+        c->windowFrames = 0;
+    } else {
+        c->windowFrames++;
+    }
+#endif
+
+    // Lights for this state, committed at the end of the frame.
+    SignalWrite(c->index, row->outputs);
+
+    // Current measurement. A calibration keeps the last reading of the state.
+    if (row->check == CHECK_CALIBRATE) {
+        if (samplerUpdate(c, curr_state))
+            c->calibrated[row->lamp] = c->measuredProbe;
+    } else if (row->check != CHECK_NONE) {
+#if ADC_SAMPLING == ADC_SAMPLING_WINDOW
+        // Load the window once the lights have settled for a frame; the
+        // ADC then checks every conversion.
+        if (c->windowFrames == ((curr_state == c->sampler.lit) ? 0 : 1))
+            windowLoad(c, curr_state);
+#else
+        // Every new reading is checked. The failure is told from the last
+        // sample, as the reading may mix samples from before it.
+        if (samplerUpdate(c, curr_state) &&
+                outOfWindow(c, c->measuredProbe, curr_state))
+            return stmFailure(c, curr_state, failedCheck(c, curr_state,
+                    c->sampler.samples[(c->sampler.head - 1) &
+                    (row->window - 1)]));
+#endif
+    }
+
+    // CROSSING button pressed. The count carries on into the next state, so
+    // that GREEN is on for at least T6 seconds in total. The lights of the
+    // next state go on with this frame, as in executeButton(), rather than a
+    // frame later.
+    if (row->button == BUTTON_REQUEST && buttonTake(c, curr_state)) {
+        int next = nextState(c, row->next);
+
+        lightNext(c, next);
+        return next;
+    }
+
+    // State exit.
+    if (leaving) {
+        c->cycleCounter = 0;
+        c->sampler.lit = -1;
+
+        if (row->button == BUTTON_CLEAR)
+            ButtonClear(c->index);
+
+        if (row->button == BUTTON_INIT) {
+            // End of a pass through all the lights.
+            if (row->next == REDINIT)
+                c->initCounter++;
+
+            // CROSSING button pressed: calibration is over. Later presses
+            // are not requests to cross.
+            if (c->initCounter > 1 && buttonTake(c, curr_state)) {
+                ButtonClear(c->index);
+                StmLimitsBuild(c);
+                CalibStore(c);
+                return REDANDDONTWALK;
+            }
+        }
+
+        return nextState(c, row->next);
+    }
+
+    c->cycleCounter++;
+    return curr_state;
+}
+
+#if STM_STATS
+volatile struct StmStats StmStats[NUMSTATES];
+volatile struct StmStats StmFrameStats;
+
+/*----------------------------------------------------------------------------*
+  Clears the statistics of one state, or of whole frames.
+ *----------------------------------------------------------------------------*/
+void stmStatsClear(volatile struct StmStats *st) {
+    int i;
+
+    st->count = 0;
+    st->min = 0xffffffff;
+    st->max = 0;
+    st->sum = 0;
+
+    for (i = 0; i < STM_HIST_BINS; i++)
+        st->hist[i] = 0;
+}
+
+/*----------------------------------------------------------------------------*
+  Clears the frame statistics.
+ *----------------------------------------------------------------------------*/
+void StmStatsReset(void) {
+    int state;
+
+    for (state = 0; state < NUMSTATES; state++)
+        stmStatsClear(&StmStats[state]);
+
+    stmStatsClear(&StmFrameStats);
+}
+
+/*----------------------------------------------------------------------------*
+  Adds the time of one frame to statistics.
+ *----------------------------------------------------------------------------*/
+void stmStatsRecord(volatile struct StmStats *st, uint32_t clocks) {
+    uint32_t c = clocks;
+    int bin = 0;
+
+    // Bin is the position of the highest bit set.
+    while (c > 1 && bin < STM_HIST_BINS - 1) {
+        c >>= 1;
+        bin++;
+    }
+
+    if (st->count == 0 || clocks < st->min)
+        st->min = clocks;
+    if (clocks > st->max)
+        st->max = clocks;
+
+    st->count++;
+    st->sum += clocks;
+    st->hist[bin]++;
+}
+#endif
+
+/*----------------------------------------------------------------------------*
+  Clock policy.
+ *----------------------------------------------------------------------------*/
+enum ClockProfile StmClockRow(int state) {
+    return (enum ClockProfile) StmTable[state].clock;
+}
+
+enum ClockProfile (*StmClockPolicy)(int state) = StmClockRow;
+
+/*----------------------------------------------------------------------------*
+  Switches to the clock profile that the crossings need for their states, if
+  not in use: the fastest that any of them asks for, which is the lowest
+  enum ClockProfile. Called once the lights of the frame are on, so a switch
+  does not delay them. A state entered by executeButton() gets its clock at
+  its first frame.
+ *----------------------------------------------------------------------------*/
+void stmClock(const struct Crossing *crossings, int n) {
+    enum ClockProfile profile, p;
+    int i;
+
+    if (!StmClockPolicy)
+        return;
+
+    profile = StmClockPolicy(crossings[0].state);
+    for (i = 1; i < n; i++) {
+        p = StmClockPolicy(crossings[i].state);
+        if (p < profile)
+            profile = p;
+    }
+
+    ClockSetProfile(profile);
+}
+
+/*----------------------------------------------------------------------------*
+  Executes one frame of the STM of a crossing and commits its lights, timed
+  with SysTickNow() when STM_STATS is set.
+ *----------------------------------------------------------------------------*/
+void executeSTM(struct Crossing *c) {
+#if STM_STATS
+    uint32_t start = SysTickNow();
+#endif
+    int curr_state = c->state;
+    int next;
+#if ADC_SAMPLING == ADC_SAMPLING_WINDOW
+    int trip;
+#endif
+
+    TraceFrame(curr_state);
+    next = stmFrame(c, curr_state);
+
+#if ADC_SAMPLING == ADC_SAMPLING_WINDOW
+    // A RED check window that tripped during the frame has turned the lights
+    // off from its interrupt: take the failure before the commit, which would
+    // light them again from the shadow, and again after it, for a trip that
+    // came between the two. The lights of an AMBER check window are left on
+    // by its interrupt, so its trip waits for the next frame.
+    if (ADCWindowSafe && (trip = windowTrip(c, curr_state)) >= 0)
+        next = trip;
+#endif
+
+    // The lights of the frame, all at once.
+    SignalCommit(c->index);
+
+#if ADC_SAMPLING == ADC_SAMPLING_WINDOW
+    if (ADCWindowSafe && (trip = windowTrip(c, curr_state)) >= 0)
+        next = trip;
+#endif
+
+    if (next != curr_state)
+        TraceRecord(TRACE_CROSSING(c->index, TRACE_STATE), next, curr_state);
+
+#if STM_STATS
+    stmStatsRecord(&StmStats[curr_state], SysTickNow() - start);
+#endif
+
+    c->state = next;
+}
+
+/*----------------------------------------------------------------------------*
+  Executes one frame of every crossing, timed as a whole when STM_STATS is
+  set. The clock for the next states is then selected, outside the timed
+  frame.
+ *----------------------------------------------------------------------------*/
+void executeFrame(struct Crossing *crossings, int n) {
+#if STM_STATS
+    uint32_t start = SysTickNow();
+#endif
+    int i;
+
+    for (i = 0; i < n; i++)
+        executeSTM(&crossings[i]);
+
+#if STM_STATS
+    stmStatsRecord(&StmFrameStats, SysTickNow() - start);
+#endif
+
+    stmClock(crossings, n);
+}
+
+/*----------------------------------------------------------------------------*
+  Handles a button press between frames, for the event-driven main loop. Only
+  a state that the button leaves at once takes the press; the others keep it
+  for their next frame.
+ *----------------------------------------------------------------------------*/
+void executeButton(struct Crossing *c) {
+    int curr_state = c->state;
+    const struct StmRow *row = &StmTable[curr_state];
+    int next;
+
+    TraceFrame(curr_state);
+    if (row->button != BUTTON_REQUEST || !buttonTake(c, curr_state))
+        return;
+
+    // As in executeSTM(), the count carries on into the next state.
+    next = nextState(c, row->next);
+    lightNext(c, next);
+    SignalCommit(c->index);
+    TraceRecord(TRACE_CROSSING(c->index, TRACE_STATE), next, curr_state);
+
+    c->state = next;
+}
@@ -0,0 +1,267 @@
+#include <MKL25Z4.H>
+#include "pelican.h"
+#include "sched.h"
+#include "trace.h"
+
+/* -------------------------------------
+ * Trace of the STM.
+ *
+ * The main loop adds records to a ring in RAM; DMA channel 1 sends the ring
+ * to UART0, one byte per transmit request, without the CPU. Adding a record
+ * encodes a few bytes and, if the DMA is idle, starts it, so it costs a few
+ * microseconds and never waits for the UART. Only the main loop writes
+ * TraceHead and only the DMA interrupt TraceTail, as in the event queues of
+ * sched.c. The ring is aligned to its size, so that the DMA source modulo
+ * wraps the transfers on it.
+ * -------------------------------------
+ */
+
+#if TRACE_INPUTS && ADC_SAMPLING != ADC_SAMPLING_SOFTWARE
+#error "TRACE_INPUTS records the conversions of ADC_SAMPLING_SOFTWARE only"
+#endif
+
+#if TRACE_INPUTS && CROSSINGS > 1
+#error "TRACE_INPUTS records the inputs of a single crossing"
+#endif
+
+#if TRACE && CROSSINGS > TRACE_CROSSINGS
+#error "CROSSINGS: the trace records carry up to TRACE_CROSSINGS crossings"
+#endif
+
+#if TRACE
+volatile uint8_t TraceRing[TRACE_RING] __attribute__((aligned(TRACE_RING)));
+
+volatile uint32_t TraceHead = 0;
+volatile uint32_t TraceTail = 0;
+volatile uint32_t TraceLost = 0;
+
+// Bytes of the transfer in progress, 0 when the DMA is idle.
+volatile uint32_t TraceSending = 0;
+
+// StampNow() of the last record and of the last sync record.
+uint32_t TraceLast = 0;
+uint32_t TraceLastSync = 0;
+
+// Lost records not yet reported by a TRACE_LOST record.
+uint32_t TraceLostPending = 0;
+
+// Largest record: type, 5 byte time, state, 5 byte value.
+#define TRACE_RECORD_MAX (12)
+
+// Start a transfer of the bytes in the ring, if there are any and the DMA
+// is idle. Called from the DMA interrupt, or with interrupts masked.
+void traceStart(void) {
+    uint32_t n = TraceHead - TraceTail;
+
+    if (TraceSending != 0 || n == 0)
+        return;
+
+    TraceSending = n;
+    DMA0->DMA[1].SAR = (uint32_t) (uintptr_t)
+            &TraceRing[TraceTail & (TRACE_RING - 1)];
+    DMA0->DMA[1].DSR_BCR = DMA_DSR_BCR_BCR(n);
+    DMA0->DMA[1].DCR |= DMA_DCR_ERQ_MASK;
+}
+
+// Append an unsigned varint.
+//   Return: bytes written
+unsigned traceVarint(uint8_t *p, uint32_t v) {
+    unsigned n = 0;
+
+    while (v >= 0x80) {
+        p[n++] = (uint8_t) (v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t) v;
+
+    return n;
+}
+
+// Copy bytes into the ring, if they fit.
+//   Return: 1 if copied, 0 if the ring is full
+int tracePut(const uint8_t *p, unsigned n) {
+    uint32_t head = TraceHead;
+    unsigned i;
+
+    if (TRACE_RING - (head - TraceTail) < n)
+        return 0;
+
+    for (i = 0; i < n; i++)
+        TraceRing[(head + i) & (TRACE_RING - 1)] = p[i];
+    TraceHead = head + n; // Publishes the bytes to the DMA.
+
+    return 1;
+}
+
+// Add a sync record.
+int traceSync(uint32_t now) {
+    uint8_t r[6];
+
+    r[0] = TRACE_SYNC_0;
+    r[1] = TRACE_SYNC_1;
+    r[2] = (uint8_t) now;
+    r[3] = (uint8_t) (now >> 8);
+    r[4] = (uint8_t) (now >> 16);
+    r[5] = (uint8_t) (now >> 24);
+
+    if (!tracePut(r, sizeof r))
+        return 0;
+
+    TraceLast = now;
+    TraceLastSync = now;
+    return 1;
+}
+
+// Add a record timed from the last one.
+int tracePutRecord(uint32_t now, unsigned type, unsigned state,
+        uint32_t value) {
+    uint8_t r[TRACE_RECORD_MAX];
+    unsigned n = 0;
+
+    r[n++] = (uint8_t) type;
+    n += traceVarint(&r[n], now - TraceLast);
+    r[n++] = (uint8_t) state;
+    n += traceVarint(&r[n], value);
+
+    if (!tracePut(r, n))
+        return 0;
+
+    TraceLast = now;
+    return 1;
+}
+
+// Add a record to the ring, and start the DMA if it is idle.
+void TraceRecord(unsigned type, unsigned state, uint32_t value) {
+    uint32_t now = StampNow();
+    int ok = 1;
+
+    if (now - TraceLastSync >= TRACE_SYNC_US)
+        ok = traceSync(now);
+
+    if (ok && TraceLostPending != 0) {
+        ok = tracePutRecord(now, TRACE_LOST, 0, TraceLostPending);
+        if (ok)
+            TraceLostPending = 0;
+    }
+
+    if (!ok || !tracePutRecord(now, type, state, value)) {
+        TraceLost++;
+        TraceLostPending++;
+    }
+
+    __disable_irq();
+    traceStart();
+    __enable_irq();
+}
+
+// Set up UART0 and the DMA channel, and queue the first sync record.
+void TraceInit(void) {
+    uint32_t best = 0xffffffff;
+    unsigned osr, bestOsr = 15, sbr, bestSbr = 1;
+
+    // Enable clock to UART0 and port A, and clock UART0 from OSCERCLK, which
+    // keeps its rate in every clock profile.
+    SIM->SCGC4 |= SIM_SCGC4_UART0_MASK;
+    SIM->SCGC5 |= SIM_SCGC5_PORTA_MASK;
+    SIM->SOPT2 = (SIM->SOPT2 & ~SIM_SOPT2_UART0SRC_MASK)
+        | SIM_SOPT2_UART0SRC(2);
+
+    // PTA2 is UART0_TX, wired to the OpenSDA serial port.
+    PORTA->PCR[2] = PORT_PCR_MUX(2);
+
+    // Oversampling ratio (OSR + 1) and divider giving the closest rate.
+    for (osr = 3; osr < 32; osr++) {
+        uint32_t rate = (osr + 1) * TRACE_BAUD;
+        uint32_t error;
+
+        sbr = (TRACE_UART_HZ + rate / 2) / rate;
+        if (sbr == 0 || sbr > 0x1fff)
+            continue;
+
+        error = (sbr * rate > TRACE_UART_HZ) ? sbr * rate - TRACE_UART_HZ
+            : TRACE_UART_HZ - sbr * rate;
+        if (error < best) {
+            best = error;
+            bestOsr = osr;
+            bestSbr = sbr;
+        }
+    }
+
+    UART0->C2 = 0; // Disable while configuring.
+    UART0->BDH = UART0_BDH_SBR(bestSbr >> 8);
+    UART0->BDL = UART0_BDL_SBR(bestSbr);
+    UART0->C4 = UART0_C4_OSR(bestOsr);
+    UART0->C1 = 0; // 8 data bits, no parity.
+
+    // A DMA request, instead of an interrupt, each time the transmit buffer
+    // is empty.
+    UART0->C5 |= UART0_C5_TDMAE_MASK;
+    UART0->C2 = UART0_C2_TIE_MASK | UART0_C2_TE_MASK;
+
+    SIM->SCGC6 |= SIM_SCGC6_DMAMUX_MASK;
+    SIM->SCGC7 |= SIM_SCGC7_DMA_MASK;
+
+    DMAMUX0->CHCFG[1] = 0; // Disable while configuring.
+
+    DMA0->DMA[1].DAR = (uint32_t) (uintptr_t) &UART0->D;
+
+    // Set DMA_DCR1
+    //   EINT --> interrupt when the byte count is done
+    //   CS --> one transfer per request
+    //   SINC, SMOD --> increment source, wrapping on the ring
+    //   SSIZE, DSIZE --> 8 bit
+    //   D_REQ --> clear ERQ when the byte count is done
+    // ERQ is set by traceStart() for each transfer.
+    DMA0->DMA[1].DCR = DMA_DCR_EINT_MASK | DMA_DCR_CS_MASK
+        | DMA_DCR_SINC_MASK | DMA_DCR_SSIZE(1) | DMA_DCR_DSIZE(1)
+        | DMA_DCR_SMOD(TRACE_RING_SMOD) | DMA_DCR_D_REQ_MASK;
+
+    DMAMUX0->CHCFG[1] = DMAMUX_CHCFG_ENBL_MASK
+        | DMAMUX_CHCFG_SOURCE(TRACE_DMA_SOURCE);
+
+    // Lowest priority: the trace can wait for the STM.
+    NVIC_SetPriority(DMA1_IRQn, 192);
+    NVIC_ClearPendingIRQ(DMA1_IRQn);
+    NVIC_EnableIRQ(DMA1_IRQn);
+
+    traceSync(StampNow());
+}
+
+// A transfer is done: free its bytes and send the ones added since.
+void DMA1_IRQHandler(void) {
+    DMA0->DMA[1].DSR_BCR = DMA_DSR_BCR_DONE_MASK; // Clear the done flag.
+    TraceTail += TraceSending;
+    TraceSending = 0;
+    traceStart();
+}
+
+#if TRACE_INPUTS
+// SysTickTicks at the last TRACE_FRAME record.
+uint32_t TraceFrameTicks = 0;
+
+// Presses of ButtonQueue[0] already recorded; counts up with its head.
+unsigned TracePressCount = 0;
+
+// Add a TRACE_FRAME record and record the new presses.
+void TraceFrame(unsigned state) {
+    uint32_t ticks = SysTickTicks;
+
+    TraceRecord(TRACE_FRAME, state, ticks - TraceFrameTicks);
+    TraceFrameTicks = ticks;
+    TracePresses();
+}
+
+// Record the presses posted since the last call, oldest first. The main
+// loop takes presses only after this has seen them, so they are still in
+// the ring.
+void TracePresses(void) {
+    struct SchedQueue *q = &ButtonQueue[0];
+    unsigned head = q->head;
+    uint32_t now = StampNow();
+
+    for (; TracePressCount != head; TracePressCount++)
+        TraceInput(TRACE_PRESS, now - q->ring[TracePressCount
+                & (q->size - 1)].stamp);
+}
+#endif
+#endif